@@ -0,0 +1,86 @@
+#include <algorithm>
+
+#include "admission.h"
+
+typedef std::chrono::steady_clock Clock;
+
+AdmissionControl::Ticket::~Ticket() {
+    if(owner)
+        owner->release(cls, admitted);
+}
+
+AdmissionControl::AdmissionControl(unsigned maxLimit) :
+    limit(std::max(1u, maxLimit / 2)), minLimit(std::max(1u, maxLimit / 8)), maxLimit(maxLimit),
+    windowStart(Clock::now()) {}
+
+bool AdmissionControl::admit(Class cls, bool priority, Ticket &ticket) {
+    Clock::time_point start = Clock::now();
+    std::unique_lock<std::mutex> guard(lock);
+    if(!canRun(cls, priority)) {
+        // Reads queue up to as many as may run at once.
+        if(cls != WRITE && waiting[cls] >= (unsigned) limit)
+            return false;
+        waiting[cls]++;
+        if(priority) priorityWaiting++;
+        bool ready = freed.wait_until(guard, start + maxWait(cls), [&] { return canRun(cls, priority); });
+        waiting[cls]--;
+        if(priority) priorityWaiting--;
+        ticket.waited = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start);
+        if(!ready) {
+            // Others may have been held back by this call's priority.
+            if(priority) freed.notify_all();
+            return false;
+        }
+    }
+    inflight++;
+    classInflight[cls]++;
+    peak = std::max(peak, inflight);
+    ticket.owner = this;
+    ticket.cls = cls;
+    ticket.admitted = Clock::now();
+    return true;
+}
+
+/* Private helper methods: */
+bool AdmissionControl::canRun(Class cls, bool priority) {
+    unsigned share = cls == LIST? std::max(1u, (unsigned) limit / 2): (unsigned) limit;
+    return inflight < (unsigned) limit && classInflight[cls] < share && (priority || priorityWaiting == 0);
+}
+
+std::chrono::milliseconds AdmissionControl::maxWait(Class cls) {
+    return std::chrono::milliseconds(cls == WRITE? 10000: 100);
+}
+
+void AdmissionControl::release(Class cls, Clock::time_point admitted) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        inflight--;
+        classInflight[cls]--;
+        if(cls == READ)
+            adjust(std::chrono::duration<double>(Clock::now() - admitted).count());
+    }
+    freed.notify_all();
+}
+
+/* Called with the lock held, for every READ call finishing. */
+void AdmissionControl::adjust(double latency) {
+    windowTotal += latency;
+    windowCount++;
+    Clock::time_point now = Clock::now();
+    if(windowCount < 50 && now - windowStart < std::chrono::seconds(1))
+        return;
+
+    double average = windowTotal / windowCount;
+    /* The baseline creeps up, so that a database that got slower for good
+     * doesn't keep the limit at its minimum. */
+    baseline = baseline == 0 || average < baseline? average: baseline * 1.01;
+    if(average > 2 * baseline)
+        limit = std::max(minLimit, limit * 0.9);
+    else if(peak >= (unsigned) limit)
+        limit = std::min(maxLimit, limit + 1);
+
+    windowTotal = 0;
+    windowCount = 0;
+    windowStart = now;
+    peak = inflight;
+}
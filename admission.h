@@ -0,0 +1,73 @@
+#ifndef _ADMISSION_H
+#define _ADMISSION_H
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+/* Admission control in front of the RPC handlers. Calls are grouped into
+ * classes, and each needs a slot under the overall concurrency limit and
+ * its class's share of it before it runs:
+ *
+ * - READ, single-object lookups, may use the whole limit.
+ * - LIST, the calls streaming a whole tournament or a player's games, may
+ *   use half of it, so they can't crowd out everything else.
+ * - WRITE calls may use the whole limit, and those with priority (HMAC
+ *   authenticated ones) are let in ahead of everything else waiting.
+ *
+ * Reads wait briefly, and are shed when their queue is full or the wait
+ * runs out; writes wait much longer. The limit adapts to the latency of READ
+ * calls, which is nearly all database time: it shrinks while they run at
+ * more than twice the best latency seen recently, and grows by one while
+ * calls are actually using all of it. */
+class AdmissionControl {
+    public:
+        enum Class { READ, LIST, WRITE, CLASSES };
+
+        // Holds a slot from admit() until destroyed.
+        class Ticket {
+            public:
+                Ticket() {}
+                Ticket(const Ticket &) = delete;
+                Ticket &operator=(const Ticket &) = delete;
+                ~Ticket();
+
+                // Time spent waiting for the slot, also set when shed.
+                std::chrono::microseconds waited{0};
+
+            private:
+                friend class AdmissionControl;
+                AdmissionControl *owner = nullptr;
+                Class cls;
+                std::chrono::steady_clock::time_point admitted;
+        };
+
+        explicit AdmissionControl(unsigned maxLimit);
+
+        /* Waits for a slot for a call of the given class. Returns false when
+         * the call should be refused instead. */
+        bool admit(Class cls, bool priority, Ticket &ticket);
+
+    private:
+        std::mutex lock;
+        std::condition_variable freed;
+
+        double limit, minLimit, maxLimit;
+        unsigned inflight = 0, peak = 0;
+        unsigned classInflight[CLASSES] = {};
+        unsigned waiting[CLASSES] = {};
+        unsigned priorityWaiting = 0;
+
+        // READ latencies since the limit was last adjusted, in seconds.
+        double baseline = 0;
+        double windowTotal = 0;
+        unsigned windowCount = 0;
+        std::chrono::steady_clock::time_point windowStart;
+
+        bool canRun(Class cls, bool priority);
+        std::chrono::milliseconds maxWait(Class cls);
+        void release(Class cls, std::chrono::steady_clock::time_point admitted);
+        void adjust(double latency);
+};
+
+#endif
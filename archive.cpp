@@ -0,0 +1,652 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "archive.h"
+#include "uuid.h"
+
+using namespace pairing_server;
+
+static const char MAGIC[8] = {'P', 'A', 'I', 'R', 'A', 'R', 'C', '1'};
+static const uint32_t NO_BLACK = UINT32_MAX;
+static const uint32_t WITHDRAWN = 1, EXPELLED = 2;
+
+struct Archive::Header {
+    char magic[8];
+    uint32_t rounds, lastRound;
+    uint32_t playerCount, gameCount, playerGameCount;
+    uint32_t name, nameLength;
+    char uuid[16];
+    uint32_t padding;
+    // Offsets of the sections, and the size of the string pool and file.
+    uint64_t players, games, playerIndex, gameIndex, playerGames, strings;
+    uint64_t stringsSize, size;
+};
+
+struct Archive::PlayerRecord {
+    char uuid[16];
+    uint32_t name, nameLength;
+    uint32_t rating, flags;
+    uint32_t firstGame, gameCount; // In the playerGames section.
+};
+
+struct Archive::GameRecord {
+    char uuid[16];
+    uint32_t white, black;
+    uint32_t round, result;
+};
+
+static uint64_t align(uint64_t offset) {
+    return (offset + 7) & ~(uint64_t) 7;
+}
+
+static uint64_t prefixOf(const std::string &uuid) {
+    uint64_t prefix = 0;
+    memcpy(&prefix, uuid.data(), std::min(uuid.size(), sizeof(prefix)));
+    return prefix;
+}
+
+static void writeFile(const std::string &path, const std::string &data) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+        throw DatabaseError("Can't create archive " + path + ": " + strerror(errno));
+    const char *p = data.data();
+    size_t left = data.size();
+    while(left > 0) {
+        ssize_t written = ::write(fd, p, left);
+        if(written < 0 && errno == EINTR)
+            continue;
+        if(written < 0) {
+            int e = errno;
+            close(fd);
+            throw DatabaseError("Write to archive " + path + " failed: " + strerror(e));
+        }
+        p += written;
+        left -= written;
+    }
+    if(fsync(fd) < 0) {
+        int e = errno;
+        close(fd);
+        throw DatabaseError("Sync of archive " + path + " failed: " + strerror(e));
+    }
+    close(fd);
+}
+
+Archive::~Archive() {
+    if(data)
+        munmap((void *) data, size);
+}
+
+std::unique_ptr<Archive> Archive::open(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+        throw DatabaseError("Can't open archive " + path + ": " + strerror(errno));
+    struct stat st;
+    if(fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(Header)) {
+        close(fd);
+        throw DatabaseError("Archive " + path + " is truncated");
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        throw DatabaseError("Can't map archive " + path + ": " + strerror(errno));
+
+    std::unique_ptr<Archive> a(new Archive());
+    a->data = (const char *) map;
+    a->size = st.st_size;
+    a->validate(path);
+    return a;
+}
+
+void Archive::write(const std::string &path, const Tournament &t,
+        const std::vector<Player> &players, const std::vector<Game> &games) {
+    std::unordered_map<std::string, uint32_t> playerIndices;
+    for(uint32_t i = 0; i < players.size(); i++) {
+        playerIndices[players[i].id().uuid()] = i;
+    }
+    auto playerOf = [&](const Player &p) {
+        auto it = playerIndices.find(p.id().uuid());
+        if(it == playerIndices.end())
+            throw DatabaseError("Game refers to a player not in the tournament");
+        return it->second;
+    };
+
+    std::vector<uint32_t> byRound(games.size());
+    for(uint32_t i = 0; i < games.size(); i++) {
+        byRound[i] = i;
+    }
+    std::stable_sort(byRound.begin(), byRound.end(), [&](uint32_t a, uint32_t b) {
+            return games[a].round() < games[b].round(); });
+
+    std::string strings;
+    auto intern = [&strings](const std::string &s) {
+        uint32_t offset = strings.size();
+        strings += s;
+        return offset;
+    };
+
+    Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(&h.magic[0], &MAGIC[0], sizeof(MAGIC));
+    h.rounds = t.rounds();
+    h.playerCount = players.size();
+    h.gameCount = games.size();
+    h.name = intern(t.name());
+    h.nameLength = t.name().size();
+    memcpy(&h.uuid[0], t.id().uuid().data(), std::min<size_t>(16, t.id().uuid().size()));
+
+    std::vector<GameRecord> gameRecords(games.size());
+    std::vector<std::vector<uint32_t>> gamesOf(players.size());
+    for(uint32_t i = 0; i < games.size(); i++) {
+        const Game &g = games[byRound[i]];
+        GameRecord &r = gameRecords[i];
+        memset(&r, 0, sizeof(r));
+        memcpy(&r.uuid[0], g.id().uuid().data(), std::min<size_t>(16, g.id().uuid().size()));
+        r.white = playerOf(g.white());
+        r.black = g.has_black()? playerOf(g.black()): NO_BLACK;
+        r.round = g.round();
+        r.result = g.result();
+        h.lastRound = std::max(h.lastRound, r.round);
+        gamesOf[r.white].push_back(i);
+        if(r.black != NO_BLACK)
+            gamesOf[r.black].push_back(i);
+    }
+
+    std::vector<PlayerRecord> playerRecords(players.size());
+    std::vector<uint32_t> playerGames;
+    for(uint32_t i = 0; i < players.size(); i++) {
+        const Player &p = players[i];
+        PlayerRecord &r = playerRecords[i];
+        memset(&r, 0, sizeof(r));
+        memcpy(&r.uuid[0], p.id().uuid().data(), std::min<size_t>(16, p.id().uuid().size()));
+        r.name = intern(p.name());
+        r.nameLength = p.name().size();
+        r.rating = p.rating();
+        r.flags = (p.withdrawn()? WITHDRAWN: 0) | (p.expelled()? EXPELLED: 0);
+        r.firstGame = playerGames.size();
+        r.gameCount = gamesOf[i].size();
+        playerGames.insert(playerGames.end(), gamesOf[i].begin(), gamesOf[i].end());
+    }
+    h.playerGameCount = playerGames.size();
+
+    std::vector<uint32_t> playerIndex(players.size()), gameIndex(games.size());
+    for(uint32_t i = 0; i < playerIndex.size(); i++) playerIndex[i] = i;
+    for(uint32_t i = 0; i < gameIndex.size(); i++) gameIndex[i] = i;
+    std::sort(playerIndex.begin(), playerIndex.end(), [&](uint32_t a, uint32_t b) {
+            return memcmp(playerRecords[a].uuid, playerRecords[b].uuid, 16) < 0; });
+    std::sort(gameIndex.begin(), gameIndex.end(), [&](uint32_t a, uint32_t b) {
+            return memcmp(gameRecords[a].uuid, gameRecords[b].uuid, 16) < 0; });
+
+    h.players = align(sizeof(Header));
+    h.games = align(h.players + playerRecords.size() * sizeof(PlayerRecord));
+    h.playerIndex = align(h.games + gameRecords.size() * sizeof(GameRecord));
+    h.gameIndex = align(h.playerIndex + playerIndex.size() * sizeof(uint32_t));
+    h.playerGames = align(h.gameIndex + gameIndex.size() * sizeof(uint32_t));
+    h.strings = align(h.playerGames + playerGames.size() * sizeof(uint32_t));
+    h.stringsSize = strings.size();
+    h.size = h.strings + strings.size();
+
+    std::string file(h.size, '\0');
+    memcpy(&file[0], &h, sizeof(h));
+    memcpy(&file[h.players], playerRecords.data(), playerRecords.size() * sizeof(PlayerRecord));
+    memcpy(&file[h.games], gameRecords.data(), gameRecords.size() * sizeof(GameRecord));
+    memcpy(&file[h.playerIndex], playerIndex.data(), playerIndex.size() * sizeof(uint32_t));
+    memcpy(&file[h.gameIndex], gameIndex.data(), gameIndex.size() * sizeof(uint32_t));
+    memcpy(&file[h.playerGames], playerGames.data(), playerGames.size() * sizeof(uint32_t));
+    memcpy(&file[h.strings], strings.data(), strings.size());
+
+    std::string tmp = path + ".tmp";
+    writeFile(tmp, file);
+    if(rename(tmp.c_str(), path.c_str()) < 0)
+        throw DatabaseError("Can't rename archive " + tmp + ": " + strerror(errno));
+}
+
+std::string Archive::uuid() const {
+    return std::string(&header().uuid[0], 16);
+}
+
+Tournament Archive::tournament() const {
+    const Header &h = header();
+    Tournament t;
+    t.mutable_id()->set_uuid(&h.uuid[0], 16);
+    t.set_name(string(h.name, h.nameLength));
+    t.set_rounds(h.rounds);
+    return t;
+}
+
+uint32_t Archive::lastRound() const {
+    return header().lastRound;
+}
+
+uint32_t Archive::playerCount() const {
+    return header().playerCount;
+}
+
+uint32_t Archive::gameCount() const {
+    return header().gameCount;
+}
+
+std::string Archive::playerUuid(uint32_t i) const {
+    return std::string(&playerRecord(i).uuid[0], 16);
+}
+
+std::string Archive::gameUuid(uint32_t i) const {
+    return std::string(&gameRecord(i).uuid[0], 16);
+}
+
+int64_t Archive::findPlayer(const std::string &uuid) const {
+    if(uuid.size() != 16)
+        return -1;
+    const uint32_t *index = table(header().playerIndex);
+    const uint32_t *end = index + header().playerCount;
+    const uint32_t *it = std::lower_bound(index, end, uuid, [this](uint32_t i, const std::string &u) {
+            return memcmp(playerRecord(i).uuid, u.data(), 16) < 0; });
+    if(it == end || memcmp(playerRecord(*it).uuid, uuid.data(), 16) != 0)
+        return -1;
+    return *it;
+}
+
+int64_t Archive::findGame(const std::string &uuid) const {
+    if(uuid.size() != 16)
+        return -1;
+    const uint32_t *index = table(header().gameIndex);
+    const uint32_t *end = index + header().gameCount;
+    const uint32_t *it = std::lower_bound(index, end, uuid, [this](uint32_t i, const std::string &u) {
+            return memcmp(gameRecord(i).uuid, u.data(), 16) < 0; });
+    if(it == end || memcmp(gameRecord(*it).uuid, uuid.data(), 16) != 0)
+        return -1;
+    return *it;
+}
+
+Player Archive::player(uint32_t i, bool withTournament) const {
+    const PlayerRecord &r = playerRecord(i);
+    Player p;
+    p.mutable_id()->set_uuid(&r.uuid[0], 16);
+    p.set_name(string(r.name, r.nameLength));
+    p.set_rating(r.rating);
+    p.set_withdrawn(r.flags & WITHDRAWN);
+    p.set_expelled(r.flags & EXPELLED);
+    if(withTournament)
+        *(p.mutable_tournament()) = tournament();
+    return p;
+}
+
+Game Archive::game(uint32_t i, bool withTournament) const {
+    const GameRecord &r = gameRecord(i);
+    Game g;
+    g.mutable_id()->set_uuid(&r.uuid[0], 16);
+    g.set_round(r.round);
+    g.set_result(static_cast<Result>(r.result));
+    // Players within games come without their flags, as from Database.
+    *(g.mutable_white()) = player(r.white, withTournament);
+    g.mutable_white()->clear_withdrawn();
+    g.mutable_white()->clear_expelled();
+    if(r.black != NO_BLACK) {
+        *(g.mutable_black()) = player(r.black, withTournament);
+        g.mutable_black()->clear_withdrawn();
+        g.mutable_black()->clear_expelled();
+    }
+    if(withTournament)
+        *(g.mutable_tournament()) = tournament();
+    return g;
+}
+
+std::vector<Player> Archive::players() const {
+    std::vector<Player> vec;
+    vec.reserve(header().playerCount);
+    for(uint32_t i = 0; i < header().playerCount; i++) {
+        vec.push_back(player(i, false));
+    }
+    return vec;
+}
+
+std::vector<Game> Archive::games() const {
+    std::vector<Game> vec;
+    vec.reserve(header().gameCount);
+    for(uint32_t i = 0; i < header().gameCount; i++) {
+        vec.push_back(game(i, false));
+    }
+    return vec;
+}
+
+std::vector<Game> Archive::playerGames(uint32_t player) const {
+    const PlayerRecord &r = playerRecord(player);
+    const uint32_t *games = table(header().playerGames) + r.firstGame;
+    std::vector<Game> vec;
+    vec.reserve(r.gameCount);
+    for(uint32_t i = 0; i < r.gameCount; i++) {
+        vec.push_back(game(games[i], false));
+    }
+    return vec;
+}
+
+/* Private helper methods: */
+const Archive::Header &Archive::header() const {
+    return *(const Header *) data;
+}
+
+const Archive::PlayerRecord &Archive::playerRecord(uint32_t i) const {
+    return ((const PlayerRecord *) (data + header().players))[i];
+}
+
+const Archive::GameRecord &Archive::gameRecord(uint32_t i) const {
+    return ((const GameRecord *) (data + header().games))[i];
+}
+
+const uint32_t *Archive::table(uint64_t offset) const {
+    return (const uint32_t *) (data + offset);
+}
+
+std::string Archive::string(uint32_t offset, uint32_t length) const {
+    return std::string(data + header().strings + offset, length);
+}
+
+/* Checks everything the accessors rely on, so that they can skip the checks
+ * on every read. */
+void Archive::validate(const std::string &path) const {
+    const Header &h = header();
+    auto fits = [&](uint64_t offset, uint64_t count, uint64_t itemSize) {
+        return offset % 8 == 0 && offset <= size && count <= (size - offset) / itemSize;
+    };
+    bool ok = memcmp(&h.magic[0], &MAGIC[0], sizeof(MAGIC)) == 0
+        && h.size == size
+        && fits(h.players, h.playerCount, sizeof(PlayerRecord))
+        && fits(h.games, h.gameCount, sizeof(GameRecord))
+        && fits(h.playerIndex, h.playerCount, sizeof(uint32_t))
+        && fits(h.gameIndex, h.gameCount, sizeof(uint32_t))
+        && fits(h.playerGames, h.playerGameCount, sizeof(uint32_t))
+        && fits(h.strings, h.stringsSize, 1)
+        && (uint64_t) h.name + h.nameLength <= h.stringsSize;
+    for(uint32_t i = 0; ok && i < h.playerCount; i++) {
+        const PlayerRecord &r = playerRecord(i);
+        ok = (uint64_t) r.name + r.nameLength <= h.stringsSize
+            && (uint64_t) r.firstGame + r.gameCount <= h.playerGameCount
+            && table(h.playerIndex)[i] < h.playerCount;
+    }
+    for(uint32_t i = 0; ok && i < h.gameCount; i++) {
+        const GameRecord &r = gameRecord(i);
+        ok = r.white < h.playerCount && (r.black == NO_BLACK || r.black < h.playerCount)
+            && table(h.gameIndex)[i] < h.gameCount;
+    }
+    for(uint32_t i = 0; ok && i < h.playerGameCount; i++) {
+        ok = table(h.playerGames)[i] < h.gameCount;
+    }
+    if(!ok)
+        throw DatabaseError("Archive " + path + " is corrupt");
+}
+
+ArchiveStore::ArchiveStore(const char *dir) : dir(dir) {}
+
+void ArchiveStore::load() {
+    std::lock_guard<std::mutex> scanning(scanLock);
+    DIR *d = opendir(dir.c_str());
+    if(!d)
+        throw DatabaseError("Can't open archive directory " + dir + ": " + strerror(errno));
+    std::vector<std::string> found;
+    struct dirent *e;
+    while((e = readdir(d)) != NULL) {
+        std::string name(e->d_name);
+        if(name.size() > 8 && name.compare(name.size() - 8, 8, ".archive") == 0)
+            found.push_back(name);
+    }
+    closedir(d);
+
+    for(const std::string &name: found) {
+        {
+            std::shared_lock<std::shared_mutex> guard(lock);
+            if(files.count(name))
+                continue;
+        }
+        try {
+            add(Archive::open(dir + "/" + name), name);
+        }
+        catch(const DatabaseError &e) {
+            std::cerr << e.what() << std::endl;
+            std::unique_lock<std::shared_mutex> guard(lock);
+            files.insert(name);
+        }
+    }
+}
+
+const Archive *ArchiveStore::tournament(const std::string &uuid) {
+    for(int attempt = 0; attempt < 2; attempt++) {
+        {
+            std::shared_lock<std::shared_mutex> guard(lock);
+            auto it = tournaments.find(uuid);
+            if(it != tournaments.end())
+                return archives[it->second].get();
+        }
+        if(attempt > 0 || !missed())
+            break;
+    }
+    return nullptr;
+}
+
+const Archive *ArchiveStore::player(const std::string &uuid, uint32_t *index) {
+    return object(uuid, index, &Archive::findPlayer);
+}
+
+const Archive *ArchiveStore::game(const std::string &uuid, uint32_t *index) {
+    return object(uuid, index, &Archive::findGame);
+}
+
+bool ArchiveStore::archive(Storage &db, const Identification &id, bool deleteRows) {
+    {
+        std::shared_lock<std::shared_mutex> guard(lock);
+        if(tournaments.count(id.uuid()))
+            return true;
+    }
+    /* This runs after every result, so the games are only loaded once the
+     * cheap checks pass, which is once per tournament. */
+    if(db.unfinishedGames(&id) > 0)
+        return false;
+    Tournament t;
+    *(t.mutable_id()) = id;
+    if(!db.getTournament(&t) || db.nextRound(&id) <= (int) t.rounds())
+        return false;
+    std::vector<Game> games = db.tournamentGames(&id);
+    uint32_t last = 0;
+    for(const Game &g: games) {
+        if(g.has_black() && g.result() == NONE)
+            return false;
+        last = std::max(last, g.round());
+    }
+    if(last < t.rounds())
+        return false;
+
+    std::string file = toHex(id.uuid()) + ".archive";
+    Archive::write(dir + "/" + file, t, db.tournamentPlayers(&id), games);
+    {
+        // A rescan may have loaded the new file already.
+        std::lock_guard<std::mutex> scanning(scanLock);
+        bool loaded;
+        {
+            std::shared_lock<std::shared_mutex> guard(lock);
+            loaded = files.count(file) > 0;
+        }
+        if(!loaded)
+            add(Archive::open(dir + "/" + file), file);
+    }
+    // Reads go to the archive from here on, so the rows can go.
+    if(deleteRows)
+        db.transaction([&] { db.deleteTournament(id); });
+    return true;
+}
+
+/* Private helper methods: */
+void ArchiveStore::add(std::unique_ptr<Archive> a, const std::string &file) {
+    std::vector<Entry> entries;
+    entries.reserve(a->playerCount() + a->gameCount());
+    for(uint32_t i = 0; i < a->playerCount(); i++) {
+        entries.push_back(Entry{prefixOf(a->playerUuid(i)), 0});
+    }
+    for(uint32_t i = 0; i < a->gameCount(); i++) {
+        entries.push_back(Entry{prefixOf(a->gameUuid(i)), 0});
+    }
+    std::sort(entries.begin(), entries.end());
+
+    std::unique_lock<std::shared_mutex> guard(lock);
+    uint32_t n = archives.size();
+    for(Entry &e: entries) {
+        e.archive = n;
+    }
+    size_t middle = objects.size();
+    objects.insert(objects.end(), entries.begin(), entries.end());
+    std::inplace_merge(objects.begin(), objects.begin() + middle, objects.end());
+
+    tournaments[a->uuid()] = n;
+    files.insert(file);
+    archives.push_back(std::move(a));
+}
+
+/* Rescans the directory if that hasn't been done for a while. Returns whether
+ * it did. */
+bool ArchiveStore::missed() {
+    int64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    int64_t last = lastScan;
+    if(now - last < 5 || !lastScan.compare_exchange_strong(last, now))
+        return false;
+    try {
+        load();
+    }
+    catch(const DatabaseError &e) {
+        std::cerr << e.what() << std::endl;
+    }
+    return true;
+}
+
+template <typename Find>
+const Archive *ArchiveStore::object(const std::string &uuid, uint32_t *index, Find find) {
+    if(uuid.size() != 16)
+        return nullptr;
+    for(int attempt = 0; attempt < 2; attempt++) {
+        {
+            std::shared_lock<std::shared_mutex> guard(lock);
+            Entry key{prefixOf(uuid), 0};
+            auto range = std::equal_range(objects.begin(), objects.end(), key);
+            for(auto it = range.first; it != range.second; it++) {
+                const Archive *a = archives[it->archive].get();
+                int64_t i = (a->*find)(uuid);
+                if(i >= 0) {
+                    *index = i;
+                    return a;
+                }
+            }
+        }
+        if(attempt > 0 || !missed())
+            break;
+    }
+    return nullptr;
+}
+
+ArchivedStorage::ArchivedStorage(ArchiveStore &store, Storage &inner) : store(store), inner(inner) {}
+
+void ArchivedStorage::begin() {
+    inner.begin();
+}
+
+void ArchivedStorage::commit() {
+    inner.commit();
+}
+
+void ArchivedStorage::rollback() {
+    inner.rollback();
+}
+
+/* The getters merge into the object passed in, which keeps any HMAC in its
+ * id, like Database does. */
+bool ArchivedStorage::getTournament(Tournament *t) {
+    if(const Archive *a = store.tournament(t->id().uuid())) {
+        t->MergeFrom(a->tournament());
+        return true;
+    }
+    return inner.getTournament(t);
+}
+
+int ArchivedStorage::nextRound(const Identification *id) {
+    if(const Archive *a = store.tournament(id->uuid()))
+        return a->lastRound() + 1;
+    return inner.nextRound(id);
+}
+
+int ArchivedStorage::unfinishedGames(const Identification *id) {
+    if(store.tournament(id->uuid()))
+        return 0;
+    return inner.unfinishedGames(id);
+}
+
+std::vector<Player> ArchivedStorage::tournamentPlayers(const Identification *id) {
+    if(const Archive *a = store.tournament(id->uuid()))
+        return a->players();
+    return inner.tournamentPlayers(id);
+}
+
+std::vector<Game> ArchivedStorage::tournamentGames(const Identification *id) {
+    if(const Archive *a = store.tournament(id->uuid()))
+        return a->games();
+    return inner.tournamentGames(id);
+}
+
+Identification ArchivedStorage::insertTournament(const Tournament *t) {
+    return inner.insertTournament(t);
+}
+
+bool ArchivedStorage::getPlayer(Player *p) {
+    uint32_t i;
+    if(const Archive *a = store.player(p->id().uuid(), &i)) {
+        p->MergeFrom(a->player(i, true));
+        return true;
+    }
+    return inner.getPlayer(p);
+}
+
+std::vector<Game> ArchivedStorage::playerGames(const Identification *id) {
+    uint32_t i;
+    if(const Archive *a = store.player(id->uuid(), &i))
+        return a->playerGames(i);
+    return inner.playerGames(id);
+}
+
+Identification ArchivedStorage::insertPlayer(const Player *p) {
+    writable(p->tournament().id().uuid());
+    return inner.insertPlayer(p);
+}
+
+bool ArchivedStorage::getGame(Game *g) {
+    uint32_t i;
+    if(const Archive *a = store.game(g->id().uuid(), &i)) {
+        g->MergeFrom(a->game(i, true));
+        return true;
+    }
+    return inner.getGame(g);
+}
+
+Identification ArchivedStorage::insertGame(const Game *g) {
+    writable(g->tournament().id().uuid());
+    return inner.insertGame(g);
+}
+
+void ArchivedStorage::registerResult(const Identification &gameId, Result result) {
+    uint32_t i;
+    if(store.game(gameId.uuid(), &i))
+        throw ArchivedError("Tournament is archived and can't be changed");
+    inner.registerResult(gameId, result);
+}
+
+void ArchivedStorage::deleteTournament(const Identification &id) {
+    inner.deleteTournament(id);
+}
+
+/* Private helper methods: */
+void ArchivedStorage::writable(const std::string &tournament) {
+    if(store.tournament(tournament))
+        throw ArchivedError("Tournament is archived and can't be changed");
+}
@@ -0,0 +1,169 @@
+#ifndef _ARCHIVE_H
+#define _ARCHIVE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "storage.h"
+
+/* A finished tournament compacted into an immutable file, which is mapped
+ * into memory and read in place. The file holds, at offsets given in the
+ * header:
+ *
+ * - the players, in the order the storage engine returned them,
+ * - the games, ordered by round,
+ * - the indices of the players and of the games sorted by UUID,
+ * - for each player, the indices of their games ordered by round,
+ * - a pool of the strings the records refer to.
+ *
+ * Integers are stored in the byte order of the machine that wrote the file. */
+class Archive {
+    public:
+        ~Archive();
+
+        static std::unique_ptr<Archive> open(const std::string &path);
+        /* Writes the tournament to path, through a temporary file that is
+         * synced and renamed into place. */
+        static void write(const std::string &path, const pairing_server::Tournament &t,
+                const std::vector<pairing_server::Player> &players,
+                const std::vector<pairing_server::Game> &games);
+
+        std::string uuid() const;
+        pairing_server::Tournament tournament() const;
+        uint32_t lastRound() const;
+        uint32_t playerCount() const;
+        uint32_t gameCount() const;
+
+        std::string playerUuid(uint32_t i) const;
+        std::string gameUuid(uint32_t i) const;
+        // Indices of the player or game with the UUID, or -1.
+        int64_t findPlayer(const std::string &uuid) const;
+        int64_t findGame(const std::string &uuid) const;
+
+        /* Objects are filled in like Database does: only single players and
+         * games come with their tournament. */
+        pairing_server::Player player(uint32_t i, bool withTournament) const;
+        pairing_server::Game game(uint32_t i, bool withTournament) const;
+        std::vector<pairing_server::Player> players() const;
+        std::vector<pairing_server::Game> games() const;
+        std::vector<pairing_server::Game> playerGames(uint32_t player) const;
+
+    private:
+        struct Header;
+        struct PlayerRecord;
+        struct GameRecord;
+
+        const char *data = nullptr;
+        size_t size = 0;
+
+        Archive() {}
+        const Header &header() const;
+        const PlayerRecord &playerRecord(uint32_t i) const;
+        const GameRecord &gameRecord(uint32_t i) const;
+        const uint32_t *table(uint64_t offset) const;
+        std::string string(uint32_t offset, uint32_t length) const;
+        void validate(const std::string &path) const;
+};
+
+/* Thrown on attempts to change an archived tournament. It is the caller's
+ * mistake rather than a failure of the storage, so the server answers it
+ * with FAILED_PRECONDITION. */
+class ArchivedError : public DatabaseError {
+    public:
+        using DatabaseError::DatabaseError;
+};
+
+/* All archives in a directory. Archives are only ever added, so pointers to
+ * them stay valid. Lookups that miss rescan the directory at most every few
+ * seconds, which picks up archives written by other servers sharing it.
+ * When servers delete archived rows, the directory must be shared by all
+ * servers using the database, or the others lose the tournament. */
+class ArchiveStore {
+    public:
+        explicit ArchiveStore(const char *dir);
+
+        // Loads the archives not loaded yet.
+        void load();
+
+        const Archive *tournament(const std::string &uuid);
+        const Archive *player(const std::string &uuid, uint32_t *index);
+        const Archive *game(const std::string &uuid, uint32_t *index);
+
+        /* Archives the tournament if every round is paired and has all its
+         * results, and optionally deletes its rows from db afterwards. Must
+         * not run concurrently with other changes to the tournament. Returns
+         * whether the tournament is archived now. db should be the engine
+         * itself rather than an ArchivedStorage, which would rescan the
+         * directory for the tournament. */
+        bool archive(Storage &db, const pairing_server::Identification &id, bool deleteRows);
+
+    private:
+        // Players and games, by the first eight bytes of their UUID.
+        struct Entry {
+            uint64_t prefix;
+            uint32_t archive;
+            bool operator<(const Entry &e) const { return prefix < e.prefix; }
+        };
+
+        std::string dir;
+        std::shared_mutex lock;
+        std::vector<std::unique_ptr<Archive>> archives;
+        std::set<std::string> files;
+        std::unordered_map<std::string, uint32_t> tournaments;
+        std::vector<Entry> objects;
+
+        std::mutex scanLock;
+        std::atomic<int64_t> lastScan{0};
+
+        void add(std::unique_ptr<Archive> a, const std::string &file);
+        bool missed();
+        template <typename Find>
+        const Archive *object(const std::string &uuid, uint32_t *index, Find find);
+};
+
+/* Storage engine serving archived tournaments from an ArchiveStore and
+ * passing everything else on to another engine. Archived tournaments can't
+ * be changed. Like the engine it wraps, one is used per thread. */
+class ArchivedStorage : public Storage {
+    public:
+        ArchivedStorage(ArchiveStore &store, Storage &inner);
+
+        void begin() override;
+        void commit() override;
+        void rollback() override;
+
+        // Operations on tournaments:
+        bool getTournament(pairing_server::Tournament *t) override;
+        int nextRound(const pairing_server::Identification *id) override;
+        int unfinishedGames(const pairing_server::Identification *id) override;
+        std::vector<pairing_server::Player> tournamentPlayers(const pairing_server::Identification *id) override;
+        std::vector<pairing_server::Game> tournamentGames(const pairing_server::Identification *id) override;
+        pairing_server::Identification insertTournament(const pairing_server::Tournament *t) override;
+
+        // Operations on players:
+        bool getPlayer(pairing_server::Player *p) override;
+        std::vector<pairing_server::Game> playerGames(const pairing_server::Identification *id) override;
+        pairing_server::Identification insertPlayer(const pairing_server::Player *p) override;
+
+        // Operations on games:
+        bool getGame(pairing_server::Game *g) override;
+        pairing_server::Identification insertGame(const pairing_server::Game *g) override;
+        void registerResult(const pairing_server::Identification &gameId, pairing_server::Result result) override;
+
+        void deleteTournament(const pairing_server::Identification &id) override;
+
+    private:
+        ArchiveStore &store;
+        Storage &inner;
+
+        void writable(const std::string &tournament);
+};
+
+#endif
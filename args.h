@@ -0,0 +1,25 @@
+#ifndef _ARGS_H
+#define _ARGS_H
+
+#include <exception>
+#include <string>
+
+/* Command line handling shared by pairing-server, pairing-simulator and
+ * pairing-replay. */
+class ArgError : public std::exception {
+    public:
+        ArgError(const char *m) : msg(m) {}
+        ArgError(std::string m) : msg(m) {}
+        const char *what() const noexcept { return msg.c_str(); }
+    private:
+        std::string msg;
+};
+
+inline const char *getArg(const char **argv, int i, int argc, const char *arg) {
+    if(i >= argc) {
+        throw ArgError(std::string("Missing argument to option --") + arg + ".\n");
+    }
+    return argv[i];
+}
+
+#endif
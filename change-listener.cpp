@@ -0,0 +1,64 @@
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <unordered_set>
+
+#include "change-listener.h"
+
+ChangeListener::ChangeListener(std::function<std::unique_ptr<Database>()> connect,
+        TournamentVersions &versions, ArchiveStore *archives) :
+    connect(connect), versions(versions), archives(archives) {}
+
+void ChangeListener::start() {
+    std::thread([this] { run(); }).detach();
+}
+
+void ChangeListener::run() {
+    for(;;) {
+        try {
+            std::unique_ptr<Database> db = connect();
+            db->listen();
+            // Whatever happened before LISTEN took effect is unknown.
+            db->forgetIds();
+            versions.reset();
+            loadArchives();
+            for(;;) {
+                std::vector<Database::Change> batch = db->changes(1000);
+                if(!batch.empty())
+                    apply(*db, batch);
+            }
+        }
+        catch(const std::exception &e) {
+            std::cerr << "Listening for changes failed: " << e.what() << std::endl;
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+}
+
+void ChangeListener::apply(Database &db, const std::vector<Database::Change> &batch) {
+    std::unordered_set<std::string> tournaments;
+    bool deleted = false;
+    for(const Database::Change &c: batch) {
+        tournaments.insert(c.tournament);
+        deleted = deleted || c.kind == 'd';
+    }
+    if(deleted) {
+        db.forgetIds();
+        loadArchives();
+    }
+    for(const std::string &t: tournaments) {
+        versions.bump(t);
+    }
+}
+
+// A directory that can't be read shouldn't stop the listening.
+void ChangeListener::loadArchives() {
+    if(!archives)
+        return;
+    try {
+        archives->load();
+    }
+    catch(const DatabaseError &e) {
+        std::cerr << e.what() << std::endl;
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef _CHANGE_LISTENER_H
+#define _CHANGE_LISTENER_H
+
+#include <functional>
+#include <memory>
+
+#include "archive.h"
+#include "database.h"
+#include "http-gateway.h"
+
+/* Keeps the caches of this server in line with the writes of other servers
+ * sharing a database, when they run with Database::notifyChanges set. A
+ * thread with its own connection LISTENs for their notifications and applies
+ * each batch received: the versions of the tournaments involved are bumped,
+ * and a deleted tournament empties the id caches of the database. While the
+ * connection is down notifications are lost, so after every (re)connect all
+ * ETags are invalidated and the id caches emptied. The mapping of players and
+ * games to their tournament never changes and needs no invalidation.
+ *
+ * With an ArchiveStore, a deleted tournament also makes it look for new
+ * archives, since another server deletes a tournament's rows once it has
+ * archived it. */
+class ChangeListener {
+    public:
+        ChangeListener(std::function<std::unique_ptr<Database>()> connect,
+                TournamentVersions &versions, ArchiveStore *archives = nullptr);
+
+        // Starts the listening thread, which runs for the life of the process.
+        void start();
+
+    private:
+        std::function<std::unique_ptr<Database>()> connect;
+        TournamentVersions &versions;
+        ArchiveStore *archives;
+
+        void run();
+        void apply(Database &db, const std::vector<Database::Change> &batch);
+        void loadArchives();
+};
+
+#endif
@@ -1,13 +1,56 @@
 #include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <openssl/rand.h>
+#include <poll.h>
 
 #include "database.h"
+#include "uuid.h"
 
 using namespace pairing_server;
 
+/* Ids only mean something within one database, so each database gets its own
+ * caches, shared by the connections of all threads. */
+struct IdCaches {
+    IdCache tournaments{1 << 12};
+    IdCache players{1 << 18};
+    IdCache games{1 << 20};
+};
+
+static IdCaches &idCaches(const char *host, const char *dbname) {
+    static std::mutex lock;
+    static std::map<std::string, IdCaches> caches;
+    std::lock_guard<std::mutex> guard(lock);
+    return caches[std::string(host? host: "") + "/" + (dbname? dbname: "")];
+}
+
+bool Database::notifyChanges = false;
+
+/* Notifications are "<origin>:<kind>:<tournament>:<object>", with the UUIDs
+ * in hex. The origin identifies this process, so that it can skip its own. */
+static const char *CHANGES_CHANNEL = "pairing_server";
+
+static const std::string &origin() {
+    static const std::string id = [] {
+        unsigned char buf[8];
+        if(RAND_bytes(&buf[0], 8) != 1)
+            throw DatabaseError("Failed to generate origin id");
+        return toHex(std::string((const char *) &buf[0], 8));
+    }();
+    return id;
+}
+
 uint32_t intify(const char *x) {
     return ntohl(*(uint32_t *) x);
 }
 
+// Booleans come as a single byte in binary results.
+bool boolify(const char *x) {
+    return *x != 0;
+}
+
 uint32_t get_int(PGresult *res, int i, const char *field) {
     return intify(PQgetvalue(res, i, PQfnumber(res, field)));
 }
@@ -50,10 +93,10 @@ void playerFromRow(Player &p, PGresult *res, int i, const char *name_col = "play
 
     // Withdrawn and expelled are optional.
     if((fnum = PQfnumber(res, withdrawn_col)) >= 0) {
-        p.set_withdrawn(intify(PQgetvalue(res, i, fnum)));
+        p.set_withdrawn(boolify(PQgetvalue(res, i, fnum)));
     }
     if((fnum = PQfnumber(res, expelled_col)) >= 0) {
-        p.set_expelled(intify(PQgetvalue(res, i, fnum)));
+        p.set_expelled(boolify(PQgetvalue(res, i, fnum)));
     }
 
     // Tournament is optional:
@@ -104,89 +147,157 @@ void Database::connect() {
         }
         throw e;
     }
+    ids = &idCaches(host, dbname);
 
     // Operations on tournaments:
     prepare("get_tournament",
-            "SELECT uuid, name, rounds FROM tournament WHERE uuid = $1", 1);
+            "SELECT id, uuid, name, rounds FROM tournament WHERE uuid = $1", 1);
     prepare("next_round",
             "SELECT MAX(round) + 1 AS round\n"
             "FROM game INNER JOIN tournament t ON tournament = t.id\n"
             "WHERE t.uuid = $1", 1);
+    prepare("next_round_by_id",
+            "SELECT MAX(round) + 1 AS round FROM game WHERE tournament = $1", 1);
+    prepare("unfinished_games",
+            "SELECT COUNT(*)::integer AS count\n"
+            "FROM game g INNER JOIN tournament t ON tournament = t.id\n"
+            "WHERE t.uuid = $1 AND black IS NOT NULL AND result IS NULL", 1);
+    prepare("unfinished_games_by_id",
+            "SELECT COUNT(*)::integer AS count FROM game\n"
+            "WHERE tournament = $1 AND black IS NOT NULL AND result IS NULL", 1);
     prepare("players",
-            "SELECT player_name, rating, p.uuid AS uuid\n"
+            "SELECT player_name, rating, withdrawn, expelled, p.uuid AS uuid, p.id AS id\n"
             "FROM player p INNER JOIN tournament t ON p.tournament = t.id\n"
             "WHERE t.uuid = $1", 1);
+    prepare("players_by_id",
+            "SELECT player_name, rating, withdrawn, expelled, uuid, id\n"
+            "FROM player WHERE tournament = $1", 1);
     prepare("tournament_games",
            "SELECT w.player_name AS white_name, w.rating AS white_rating, w.uuid AS white_uuid,\n"
            "       b.player_name AS black_name, b.rating AS black_rating, b.uuid AS black_uuid,\n"
-           "       result, round, g.uuid AS uuid\n"
+           "       w.id AS white_id, b.id AS black_id,\n"
+           "       result, round, g.uuid AS uuid, g.id AS id\n"
            "FROM game g INNER JOIN tournament t ON tournament = t.id\n"
            "            INNER JOIN player w ON white = w.id\n"
            "            LEFT  JOIN player b ON black = b.id\n"
-           "WHERE t.uuid = $1", 1);
+           "WHERE t.uuid = $1\n"
+           "ORDER BY round", 1);
+    prepare("tournament_games_by_id",
+           "SELECT w.player_name AS white_name, w.rating AS white_rating, w.uuid AS white_uuid,\n"
+           "       b.player_name AS black_name, b.rating AS black_rating, b.uuid AS black_uuid,\n"
+           "       w.id AS white_id, b.id AS black_id,\n"
+           "       result, round, g.uuid AS uuid, g.id AS id\n"
+           "FROM game g INNER JOIN player w ON white = w.id\n"
+           "            LEFT  JOIN player b ON black = b.id\n"
+           "WHERE g.tournament = $1\n"
+           "ORDER BY round", 1);
 
     prepare("insert_tournament",
-            "INSERT INTO tournament(name, rounds) VALUES ($1, $2) RETURNING uuid", 2);
+            "INSERT INTO tournament(uuid, name, rounds)\n"
+            "VALUES (COALESCE($3, uuid_generate_v4()), $1, $2)\n"
+            "RETURNING id, uuid", 3);
+    prepare("tournaments_between",
+            "SELECT id, uuid, name, rounds FROM tournament WHERE uuid BETWEEN $1 AND $2", 2);
 
     // Operations on players:
     prepare("get_player",
-            "SELECT p.uuid AS uuid, player_name, rating, withdrawn, expelled,\n"
-            "   t.name AS tournament_name, t.uuid AS tournament_uuid, rounds\n"
+            "SELECT p.uuid AS uuid, p.id AS id, player_name, rating, withdrawn, expelled,\n"
+            "   t.name AS tournament_name, t.uuid AS tournament_uuid, t.id AS tournament_id, rounds\n"
             "FROM player p INNER JOIN tournament t ON tournament = t.id\n"
             "WHERE p.uuid = $1", 1);
     prepare("insert_player",
-            "INSERT INTO player(player_name, rating, tournament)\n"
-            "SELECT $1, $2, id FROM tournament WHERE uuid = $3\n"
-            "RETURNING uuid", 3);
+            "INSERT INTO player(uuid, player_name, rating, tournament, withdrawn, expelled)\n"
+            "SELECT COALESCE($4, uuid_generate_v4()), $1, $2, id, $5, $6 FROM tournament WHERE uuid = $3\n"
+            "RETURNING id, uuid", 6);
+    prepare("insert_player_by_id",
+            "INSERT INTO player(uuid, player_name, rating, tournament, withdrawn, expelled)\n"
+            "VALUES (COALESCE($4, uuid_generate_v4()), $1, $2, $3, $5, $6)\n"
+            "RETURNING id, uuid", 6);
     prepare("player_games",
            "SELECT w.player_name AS white_name, w.rating AS white_rating, w.uuid AS white_uuid,\n"
            "       b.player_name AS black_name, b.rating AS black_rating, b.uuid AS black_uuid,\n"
-           "       result, round, g.uuid AS uuid\n"
+           "       w.id AS white_id, b.id AS black_id,\n"
+           "       result, round, g.uuid AS uuid, g.id AS id\n"
            "FROM game g INNER JOIN player w ON white = w.id\n"
            "            LEFT  JOIN player b ON black = b.id\n"
            "WHERE w.uuid = $1 or b.uuid = $1\n"
            "ORDER BY round", 1);
+    prepare("player_games_by_id",
+           "SELECT w.player_name AS white_name, w.rating AS white_rating, w.uuid AS white_uuid,\n"
+           "       b.player_name AS black_name, b.rating AS black_rating, b.uuid AS black_uuid,\n"
+           "       w.id AS white_id, b.id AS black_id,\n"
+           "       result, round, g.uuid AS uuid, g.id AS id\n"
+           "FROM game g INNER JOIN player w ON white = w.id\n"
+           "            LEFT  JOIN player b ON black = b.id\n"
+           "WHERE white = $1 or black = $1\n"
+           "ORDER BY round", 1);
 
     // Operations on games:
     prepare("get_game",
            "SELECT w.player_name AS white_name, w.rating AS white_rating, w.uuid AS white_uuid,\n"
            "       b.player_name AS black_name, b.rating AS black_rating, b.uuid AS black_uuid,\n"
-           "       result, round, g.uuid AS uuid,\n"
-           "       rounds, t.name AS tournament_name, t.uuid AS tournament_uuid\n"
+           "       w.id AS white_id, b.id AS black_id,\n"
+           "       result, round, g.uuid AS uuid, g.id AS id,\n"
+           "       rounds, t.name AS tournament_name, t.uuid AS tournament_uuid, t.id AS tournament_id\n"
            "FROM game g INNER JOIN tournament t ON tournament = t.id\n"
            "            INNER JOIN player w ON white = w.id\n"
            "            LEFT  JOIN player b ON black = b.id\n"
            "WHERE g.uuid = $1", 1);
     prepare("insert_game",
-            "INSERT INTO game(tournament, white, black, round)\n"
-            "SELECT t.id, w.id, b.id, $4\n"
+            "INSERT INTO game(uuid, tournament, white, black, round)\n"
+            "SELECT COALESCE($5, uuid_generate_v4()), t.id, w.id, b.id, $4\n"
             "FROM tournament t, player w, player b\n"
             "WHERE t.uuid = $1 AND w.uuid = $2 AND b.uuid = $3\n"
-            "RETURNING uuid", 4);
+            "RETURNING id, uuid", 5);
     prepare("insert_game_without_black",
-            "INSERT INTO game(tournament, white, round)\n"
-            "SELECT t.id, w.id, $3\n"
+            "INSERT INTO game(uuid, tournament, white, round)\n"
+            "SELECT COALESCE($4, uuid_generate_v4()), t.id, w.id, $3\n"
             "FROM tournament t, player w\n"
             "WHERE t.uuid = $1 AND w.uuid = $2\n"
-            "RETURNING uuid", 3);
+            "RETURNING id, uuid", 4);
     prepare("insert_game_with_result",
-            "INSERT INTO game(tournament, white, black, round, result)\n"
-            "SELECT t.id, w.id, b.id, $4, $5\n"
+            "INSERT INTO game(uuid, tournament, white, black, round, result)\n"
+            "SELECT COALESCE($6, uuid_generate_v4()), t.id, w.id, b.id, $4, $5\n"
             "FROM tournament t, player w, player b\n"
             "WHERE t.uuid = $1 AND w.uuid = $2 AND b.uuid = $3\n"
-            "RETURNING uuid", 5);
+            "RETURNING id, uuid", 6);
     prepare("insert_game_with_result_without_black",
-            "INSERT INTO game(tournament, white, round, result)\n"
-            "SELECT t.id, w.id, $3, $4\n"
+            "INSERT INTO game(uuid, tournament, white, round, result)\n"
+            "SELECT COALESCE($5, uuid_generate_v4()), t.id, w.id, $3, $4\n"
             "FROM tournament t, player w\n"
             "WHERE t.uuid = $1 AND w.uuid = $2\n"
-            "RETURNING uuid", 4);
+            "RETURNING id, uuid", 5);
+    /* Once the ids are known, one statement covers all four variants above:
+     * a NULL black or result is the same as leaving the column out. */
+    prepare("insert_game_by_id",
+            "INSERT INTO game(uuid, tournament, white, black, round, result)\n"
+            "VALUES (COALESCE($6, uuid_generate_v4()), $1, $2, $3, $4, $5)\n"
+            "RETURNING id, uuid", 6);
 
     /* XXX: Consider forcing register_result to only work on games with no
      * result (by adding WHERE result IS NULL) and adding a separate query to
      * update a result. */
     prepare("register_result",
-            "UPDATE game SET result = $1 WHERE uuid = $2", 2);
+            "UPDATE game g SET result = $1 FROM tournament t\n"
+            "WHERE g.uuid = $2 AND t.id = g.tournament\n"
+            "RETURNING g.id AS id, t.uuid AS tournament_uuid", 2);
+    prepare("register_result_by_id",
+            "UPDATE game g SET result = $1 FROM tournament t\n"
+            "WHERE g.id = $2 AND t.id = g.tournament\n"
+            "RETURNING g.id AS id, t.uuid AS tournament_uuid", 2);
+
+    // Used when moving a tournament to another shard:
+    prepare("delete_tournament_games",
+            "DELETE FROM game WHERE tournament = (SELECT id FROM tournament WHERE uuid = $1)\n"
+            "RETURNING uuid", 1);
+    prepare("delete_tournament_players",
+            "DELETE FROM player WHERE tournament = (SELECT id FROM tournament WHERE uuid = $1)\n"
+            "RETURNING uuid", 1);
+    prepare("delete_tournament",
+            "DELETE FROM tournament WHERE uuid = $1 RETURNING uuid", 1);
+
+    prepare("notify_changes",
+            (std::string("SELECT pg_notify('") + CHANGES_CHANNEL + "', c) FROM unnest($1::text[]) AS c").c_str(), 1);
 }
 
 Database::~Database() {
@@ -206,9 +317,40 @@ void Database::sqlDo(const char *sql) {
     }
 }
 
-void Database::begin() { sqlDo("BEGIN"); }
-void Database::commit() { sqlDo("COMMIT"); }
-void Database::rollback() { sqlDo("ROLLBACK"); }
+void Database::begin() {
+    sqlDo("BEGIN");
+    inTransaction = true;
+}
+
+void Database::commit() {
+    // Notifications are only delivered if the transaction commits.
+    try {
+        sendChanges();
+    }
+    catch(...) {
+        rollback();
+        throw;
+    }
+    inTransaction = false;
+    try {
+        sqlDo("COMMIT");
+    }
+    catch(...) {
+        pendingIds.clear();
+        throw;
+    }
+    for(auto &pending: pendingIds) {
+        std::get<0>(pending)->put(std::get<1>(pending), std::get<2>(pending));
+    }
+    pendingIds.clear();
+}
+
+void Database::rollback() {
+    inTransaction = false;
+    pendingIds.clear();
+    pendingChanges.clear();
+    sqlDo("ROLLBACK");
+}
 
 bool Database::getTournament(Tournament *t) {
     const char *values[] = {t->id().uuid().c_str()};
@@ -220,6 +362,7 @@ bool Database::getTournament(Tournament *t) {
     if(PQntuples(res) > 0) {
         found = true;
         tournamentFromRow(*t, res, 0);
+        remember(ids->tournaments, res, 0, "uuid", "id");
     }
 
     PQclear(res);
@@ -227,10 +370,7 @@ bool Database::getTournament(Tournament *t) {
 }
 
 int Database::nextRound(const Identification *id) {
-    const char *values[] = {id->uuid().c_str()};
-    const int formats[] = {1};
-    const int lengths[] = {16};
-    PGresult *res = execute("next_round", 1, &values[0], &lengths[0], &formats[0], 1, 1, 1);
+    PGresult *res = executeById("next_round_by_id", "next_round", ids->tournaments, id, 1, 1);
     int round = PQgetisnull(res, 0, PQfnumber(res, "round"))?
         1:
         get_int(res, 0, "round");
@@ -238,42 +378,49 @@ int Database::nextRound(const Identification *id) {
     return round;
 }
 
+int Database::unfinishedGames(const Identification *id) {
+    PGresult *res = executeById("unfinished_games_by_id", "unfinished_games", ids->tournaments, id, 1, 1);
+    int count = get_int(res, 0, "count");
+    PQclear(res);
+    return count;
+}
+
 std::vector<Player> Database::tournamentPlayers(const Identification *id) {
-    const char *values[] = {id->uuid().c_str()};
-    const int formats[] = {1};
-    const int lengths[] = {16};
-    PGresult *res = execute("players", 1, &values[0], &lengths[0], &formats[0], 1);
+    PGresult *res = executeById("players_by_id", "players", ids->tournaments, id);
     std::vector<Player> vec(PQntuples(res));
     for(int i = 0; i < PQntuples(res); i++) {
         playerFromRow(vec[i], res, i);
+        remember(ids->players, res, i, "uuid", "id");
     }
     PQclear(res);
     return vec;
 }
 
 std::vector<Game> Database::tournamentGames(const Identification *id) {
-    const char *values[] = {id->uuid().c_str()};
-    const int formats[] = {1};
-    const int lengths[] = {16};
-    PGresult *res = execute("tournament_games", 1, &values[0], &lengths[0], &formats[0], 1);
+    PGresult *res = executeById("tournament_games_by_id", "tournament_games", ids->tournaments, id);
     std::vector<Game> vec(PQntuples(res));
     for(int i = 0; i < PQntuples(res); i++) {
         gameFromRow(vec[i], res, i);
+        rememberGame(res, i);
     }
     PQclear(res);
     return vec;
 }
 
 Identification Database::insertTournament(const Tournament *t) {
+    SingleWrite single(*this);
     uint32_t netRounds = htonl(t->rounds());
-    const char *values[] = {t->name().c_str(), (char *) &netRounds};
-    const int formats[] = {0, 1};
-    const int lengths[] = {0, sizeof(uint32_t)};
-    PGresult *res = execute("insert_tournament", 2, &values[0], &lengths[0], &formats[0], 1, 1, 1);
+    const char *values[] = {t->name().c_str(), (char *) &netRounds, presetUuid(t->id())};
+    const int formats[] = {0, 1, 1};
+    const int lengths[] = {0, sizeof(uint32_t), 16};
+    PGresult *res = execute("insert_tournament", 3, &values[0], &lengths[0], &formats[0], 1, 1, 1);
     /* TODO: Assert that a row is returned. */
     Identification ident;
     ident.set_uuid(PQgetvalue(res, 0, PQfnumber(res, "uuid")), 16);
+    remember(ids->tournaments, res, 0, "uuid", "id");
     PQclear(res);
+    changed('t', ident.uuid(), ident.uuid());
+    single.commit();
     return ident;
 }
 
@@ -286,34 +433,49 @@ bool Database::getPlayer(Player *p) {
     if(PQntuples(res) > 0) {
         found = true;
         playerFromRow(*p, res, 0);
+        remember(ids->players, res, 0, "uuid", "id");
+        remember(ids->tournaments, res, 0, "tournament_uuid", "tournament_id");
     }
     PQclear(res);
     return found;
 }
 
 std::vector<Game> Database::playerGames(const Identification *id) {
-    const char *values[] = {id->uuid().c_str()};
-    const int lengths[] = {16};
-    const int formats[] = {1};
-    PGresult *res = execute("player_games", 1, &values[0], &lengths[0], &formats[0], 1);
+    PGresult *res = executeById("player_games_by_id", "player_games", ids->players, id);
     std::vector<Game> vec(PQntuples(res));
     for(int i = 0; i < PQntuples(res); i++) {
         gameFromRow(vec[i], res, i);
+        rememberGame(res, i);
     }
+    PQclear(res);
     return vec;
 }
 
 Identification Database::insertPlayer(const Player *p) {
+    SingleWrite single(*this);
     uint32_t netRating = htonl(p->rating());
+    int32_t tournament;
+    uint32_t netTournament;
+    char withdrawn = p->withdrawn(), expelled = p->expelled();
     const char *values[] = {p->name().c_str(), (char *) &netRating,
-        p->tournament().id().uuid().c_str()};
-    const int formats[] = {0, 1, 1};
-    const int lengths[] = {0, sizeof(uint32_t), 16};
-    PGresult *res = execute("insert_player", 3, &values[0], &lengths[0], &formats[0], 1, 1, 1);
+        p->tournament().id().uuid().c_str(), presetUuid(p->id()), &withdrawn, &expelled};
+    const int formats[] = {0, 1, 1, 1, 1, 1};
+    int lengths[] = {0, sizeof(uint32_t), 16, 16, 1, 1};
+    const char *query = "insert_player";
+    if(ids->tournaments.get(p->tournament().id().uuid(), &tournament)) {
+        netTournament = htonl(tournament);
+        values[2] = (char *) &netTournament;
+        lengths[2] = sizeof(uint32_t);
+        query = "insert_player_by_id";
+    }
+    PGresult *res = execute(query, 6, &values[0], &lengths[0], &formats[0], 1, 1, 1);
     /* TODO: Make sure we actually get a row back. */
     Identification ident;
     ident.set_uuid(PQgetvalue(res, 0, PQfnumber(res, "uuid")), 16);
+    remember(ids->players, res, 0, "uuid", "id");
     PQclear(res);
+    changed('p', p->tournament().id().uuid(), ident.uuid());
+    single.commit();
     return ident;
 }
 
@@ -326,20 +488,49 @@ bool Database::getGame(Game *g) {
     if(PQntuples(res) > 0) {
         found = true;
         gameFromRow(*g, res, 0);
+        rememberGame(res, 0);
+        remember(ids->tournaments, res, 0, "tournament_uuid", "tournament_id");
     }
     PQclear(res);
     return found;
 }
 
 Identification Database::insertGame(const Game *g) {
+    SingleWrite single(*this);
     PGresult *res;
+    int32_t tournament, white, black = 0;
+    if(ids->tournaments.get(g->tournament().id().uuid(), &tournament)
+            && ids->players.get(g->white().id().uuid(), &white)
+            && (!g->has_black() || ids->players.get(g->black().id().uuid(), &black))) {
+        uint32_t netIds[] = {htonl(tournament), htonl(white), htonl(black)};
+        uint32_t netRound = htonl(g->round());
+        uint32_t netResult = htonl(g->result());
+        const char *values[] = {(char *) &netIds[0], (char *) &netIds[1],
+            g->has_black()? (char *) &netIds[2]: NULL,
+            (char *) &netRound,
+            g->result() > 0? (char *) &netResult: NULL,
+            presetUuid(g->id())};
+        const int lengths[] = {sizeof(uint32_t), sizeof(uint32_t), sizeof(uint32_t),
+            sizeof(uint32_t), sizeof(uint32_t), 16};
+        const int formats[] = {1, 1, 1, 1, 1, 1};
+        res = execute("insert_game_by_id", 6, &values[0], &lengths[0], &formats[0], 1, 1, 1);
+        Identification id;
+        id.set_uuid(PQgetvalue(res, 0, PQfnumber(res, "uuid")), 16);
+        remember(ids->games, res, 0, "uuid", "id");
+        PQclear(res);
+        changed('g', g->tournament().id().uuid(), id.uuid());
+        single.commit();
+        return id;
+    }
+
     const char *values[] = {g->tournament().id().uuid().c_str(),
         g->white().id().uuid().c_str(),
         NULL,
         NULL,
+        NULL,
         NULL};
-    int lengths[] = {16, 16, 0, 0, 0};
-    int formats[] = {1, 1, 1, 1, 1};
+    int lengths[] = {16, 16, 0, 0, 0, 0};
+    int formats[] = {1, 1, 1, 1, 1, 1};
     int params = 2;
 
     if(g->has_black()) {
@@ -359,6 +550,9 @@ Identification Database::insertGame(const Game *g) {
         lengths[params++] = sizeof(uint32_t);
     }
 
+    values[params] = presetUuid(g->id());
+    lengths[params++] = 16;
+
     const char *query = g->result() > 0 && g->has_black()? "insert_game_with_result":
                         g->result() > 0? "insert_game_with_result_without_black":
                         g->has_black()? "insert_game":
@@ -367,20 +561,253 @@ Identification Database::insertGame(const Game *g) {
 
     Identification id;
     id.set_uuid(PQgetvalue(res, 0, PQfnumber(res, "uuid")), 16);
+    remember(ids->games, res, 0, "uuid", "id");
     PQclear(res);
+    changed('g', g->tournament().id().uuid(), id.uuid());
+    single.commit();
     return id;
 }
 
 void Database::registerResult(const Identification &gameId, Result result) {
+    SingleWrite single(*this);
     uint32_t netResult = htonl(result);
+    int32_t game;
+    uint32_t netGame;
     const char *values[] = {(char *) &netResult, gameId.uuid().c_str()};
-    const int formats[] = {0, 1};
-    const int lengths[] = {0, sizeof(uint32_t)};
-    PGresult *res = execute("register_result", 2, &values[0], &lengths[0], &formats[0], 1, 1, 1);
+    const int formats[] = {1, 1};
+    int lengths[] = {sizeof(uint32_t), 16};
+    bool cached = ids->games.get(gameId.uuid(), &game);
+    if(cached) {
+        netGame = htonl(game);
+        values[1] = (char *) &netGame;
+        lengths[1] = sizeof(uint32_t);
+    }
+    PGresult *res = execute(cached? "register_result_by_id": "register_result", 2,
+            &values[0], &lengths[0], &formats[0], 1, 1, 1);
+    if(!cached)
+        remember(ids->games, gameId.uuid(), get_int(res, 0, "id"));
+    std::string tournament(PQgetvalue(res, 0, PQfnumber(res, "tournament_uuid")), 16);
     PQclear(res);
+    changed('r', tournament, gameId.uuid());
+    single.commit();
+}
+
+std::vector<Tournament> Database::tournamentsBetween(const std::string &from, const std::string &to) {
+    const char *values[] = {from.c_str(), to.c_str()};
+    const int lengths[] = {16, 16};
+    const int formats[] = {1, 1};
+    PGresult *res = execute("tournaments_between", 2, &values[0], &lengths[0], &formats[0], 1);
+    std::vector<Tournament> vec(PQntuples(res));
+    for(int i = 0; i < PQntuples(res); i++) {
+        tournamentFromRow(vec[i], res, i);
+    }
+    PQclear(res);
+    return vec;
+}
+
+void Database::deleteTournament(const Identification &id) {
+    SingleWrite single(*this);
+    const char *values[] = {id.uuid().c_str()};
+    const int lengths[] = {16};
+    const int formats[] = {1};
+    const char *stmts[] = {"delete_tournament_games", "delete_tournament_players", "delete_tournament"};
+    IdCache *caches[] = {&ids->games, &ids->players, &ids->tournaments};
+    for(int i = 0; i < 3; i++) {
+        PGresult *res = execute(stmts[i], 1, &values[0], &lengths[0], &formats[0], 1);
+        for(int j = 0; j < PQntuples(res); j++) {
+            caches[i]->erase(std::string(PQgetvalue(res, j, 0), 16));
+        }
+        PQclear(res);
+    }
+    changed('d', id.uuid(), "");
+    single.commit();
+}
+
+/* The shard of every bucket is recorded in the first shard, where servers
+ * sharing the shards check their shard files against it. The statements are
+ * only prepared on the connection that uses them, since databases that
+ * aren't sharded don't have the table. */
+void Database::prepareBuckets() {
+    if(bucketsPrepared)
+        return;
+    prepare("lock_buckets_shared",
+            "SELECT pg_advisory_lock_shared(hashtext('pairing_server.shard_bucket'))", 0);
+    prepare("try_lock_buckets",
+            "SELECT pg_try_advisory_lock(hashtext('pairing_server.shard_bucket')) AS locked", 0);
+    prepare("unlock_buckets",
+            "SELECT pg_advisory_unlock(hashtext('pairing_server.shard_bucket'))", 0);
+    prepare("get_buckets", "SELECT bucket, shard FROM shard_bucket", 0);
+    prepare("record_buckets",
+            "INSERT INTO shard_bucket(bucket, shard)\n"
+            "SELECT b - 1, s FROM unnest($1::integer[]) WITH ORDINALITY AS a(s, b)\n"
+            "ON CONFLICT DO NOTHING", 1);
+    prepare("set_buckets",
+            "UPDATE shard_bucket SET shard = $3 WHERE bucket BETWEEN $1 AND $2", 3);
+    bucketsPrepared = true;
+}
+
+void Database::lockBucketsShared() {
+    prepareBuckets();
+    PQclear(execute("lock_buckets_shared", 0, NULL, NULL, NULL, 1));
+}
+
+bool Database::tryLockBuckets() {
+    prepareBuckets();
+    PGresult *res = execute("try_lock_buckets", 0, NULL, NULL, NULL, 1, 1, 1);
+    bool locked = boolify(PQgetvalue(res, 0, 0));
+    PQclear(res);
+    return locked;
+}
+
+void Database::unlockBuckets() {
+    prepareBuckets();
+    PQclear(execute("unlock_buckets", 0, NULL, NULL, NULL, 1));
+}
+
+std::vector<uint16_t> Database::buckets() {
+    prepareBuckets();
+    PGresult *res = execute("get_buckets", 0, NULL, NULL, NULL, 1);
+    std::vector<uint16_t> vec;
+    if(PQntuples(res) > 0)
+        vec.assign(1 << 16, UINT16_MAX);
+    for(int i = 0; i < PQntuples(res); i++) {
+        uint32_t bucket = get_int(res, i, "bucket");
+        if(bucket < vec.size())
+            vec[bucket] = get_int(res, i, "shard");
+    }
+    PQclear(res);
+    return vec;
+}
+
+void Database::recordBuckets(const std::vector<uint16_t> &buckets) {
+    prepareBuckets();
+    std::string array = "{";
+    for(size_t b = 0; b < buckets.size(); b++) {
+        if(b > 0)
+            array += ',';
+        array += std::to_string(buckets[b]);
+    }
+    array += '}';
+    const char *values[] = {array.c_str()};
+    const int lengths[] = {0};
+    const int formats[] = {0};
+    PQclear(execute("record_buckets", 1, &values[0], &lengths[0], &formats[0], 1));
+}
+
+void Database::setBuckets(uint32_t first, uint32_t last, uint16_t shard) {
+    prepareBuckets();
+    uint32_t netFirst = htonl(first), netLast = htonl(last), netShard = htonl(shard);
+    const char *values[] = {(char *) &netFirst, (char *) &netLast, (char *) &netShard};
+    const int lengths[] = {sizeof(uint32_t), sizeof(uint32_t), sizeof(uint32_t)};
+    const int formats[] = {1, 1, 1};
+    PQclear(execute("set_buckets", 3, &values[0], &lengths[0], &formats[0], 1));
+}
+
+void Database::listen() {
+    sqlDo((std::string("LISTEN ") + CHANGES_CHANNEL).c_str());
+}
+
+std::vector<Database::Change> Database::changes(int timeout) {
+    std::vector<Change> batch;
+    for(int attempt = 0; attempt < 2 && batch.empty(); attempt++) {
+        if(attempt > 0) {
+            struct pollfd fd = {PQsocket(db), POLLIN, 0};
+            if(poll(&fd, 1, timeout) < 0 && errno != EINTR)
+                throw DatabaseError(strerror(errno));
+        }
+        if(!PQconsumeInput(db) || PQstatus(db) == CONNECTION_BAD)
+            throw DatabaseError(PQerrorMessage(db));
+
+        PGnotify *n;
+        while((n = PQnotifies(db)) != NULL) {
+            std::string payload(n->extra);
+            PQfreemem(n);
+            size_t a = payload.find(':'), b = payload.find(':', a + 1), c = payload.find(':', b + 1);
+            if(c == std::string::npos || payload.compare(0, a, origin()) == 0 || b != a + 2)
+                continue;
+            Change change{payload[a + 1], "", ""};
+            if(fromHex(payload.substr(b + 1, c - b - 1), &change.tournament)
+                    && fromHex(payload.substr(c + 1), &change.object))
+                batch.push_back(change);
+        }
+    }
+    return batch;
+}
+
+void Database::forgetIds() {
+    ids->tournaments.clear();
+    ids->players.clear();
+    ids->games.clear();
 }
 
 /* Private helper methods: */
+const char *Database::presetUuid(const Identification &id) {
+    return id.uuid().size() == 16? id.uuid().c_str(): NULL;
+}
+
+void Database::remember(IdCache &cache, PGresult *res, int i, const char *uuidCol, const char *idCol) {
+    int uuidNum = PQfnumber(res, uuidCol), idNum = PQfnumber(res, idCol);
+    if(uuidNum < 0 || idNum < 0 || PQgetisnull(res, i, uuidNum) || PQgetisnull(res, i, idNum))
+        return;
+    remember(cache, std::string(PQgetvalue(res, i, uuidNum), 16), get_int(res, i, idCol));
+}
+
+void Database::remember(IdCache &cache, const std::string &uuid, int32_t id) {
+    if(inTransaction)
+        pendingIds.emplace_back(&cache, uuid, id);
+    else
+        cache.put(uuid, id);
+}
+
+void Database::rememberGame(PGresult *res, int i) {
+    remember(ids->games, res, i, "uuid", "id");
+    remember(ids->players, res, i, "white_uuid", "white_id");
+    remember(ids->players, res, i, "black_uuid", "black_id");
+}
+
+/* Writes always run in a transaction when changes are notified, see
+ * SingleWrite, so the notifications all go out in a single statement before
+ * it commits. */
+void Database::changed(char kind, const std::string &tournament, const std::string &object) {
+    if(!notifyChanges)
+        return;
+    pendingChanges.push_back(origin() + ":" + kind + ":" + toHex(tournament) + ":" + toHex(object));
+}
+
+void Database::sendChanges() {
+    if(pendingChanges.empty())
+        return;
+    // An array literal; the elements need no quoting.
+    std::string array = "{";
+    for(size_t i = 0; i < pendingChanges.size(); i++) {
+        if(i > 0) array += ',';
+        array += pendingChanges[i];
+    }
+    array += '}';
+    pendingChanges.clear();
+    const char *values[] = {array.c_str()};
+    const int lengths[] = {0};
+    const int formats[] = {0};
+    PQclear(execute("notify_changes", 1, &values[0], &lengths[0], &formats[0], 0));
+}
+
+/* Runs the id-keyed variant of a statement if the id for the UUID is cached,
+ * and the UUID-keyed one otherwise. */
+PGresult *Database::executeById(const char *idStmt, const char *uuidStmt, IdCache &cache,
+        const Identification *id, int minRows, int maxRows) {
+    int32_t rowId;
+    const int formats[] = {1};
+    if(cache.get(id->uuid(), &rowId)) {
+        uint32_t netId = htonl(rowId);
+        const char *values[] = {(char *) &netId};
+        const int lengths[] = {sizeof(uint32_t)};
+        return execute(idStmt, 1, &values[0], &lengths[0], &formats[0], 1, minRows, maxRows);
+    }
+    const char *values[] = {id->uuid().c_str()};
+    const int lengths[] = {16};
+    return execute(uuidStmt, 1, &values[0], &lengths[0], &formats[0], 1, minRows, maxRows);
+}
+
 void Database::prepare(const char *name, const char *sql, int count) {
     PGresult *res = PQprepare(db, name, sql, count, NULL);
     if(!res || PQresultStatus(res) != PGRES_COMMAND_OK) {
@@ -1,15 +1,17 @@
 #ifndef _DATABASE_H
 #define _DATABASE_H
 
-#include <exception>
 #include <postgresql/libpq-fe.h>
 #include <string>
+#include <tuple>
 #include <vector>
 
-#include "service.pb.h"
-#include "types.pb.h"
+#include "id-cache.h"
+#include "storage.h"
 
-class Database {
+struct IdCaches;
+
+class Database : public Storage {
     public:
         Database();
         Database(const char *dbname, const char *user, const char *password,
@@ -18,46 +20,120 @@ class Database {
 
         void connect();
 
-        void begin();
-        void commit();
-        void rollback();
-
-        template<typename Func>
-        void transaction(Func cb) {
-            begin();
-            try {
-                cb();
-            }
-            catch(...) {
-                rollback();
-                throw;
-            }
-            commit();
-        }
+        /* When set, every write tells the other servers using the database
+         * about it with a NOTIFY, sent as part of the write's transaction.
+         * Writes made outside a transaction then get one of their own. */
+        static bool notifyChanges;
+
+        /* A write made by another server. kind is 't' for an inserted
+         * tournament, 'p' for a player, 'g' for a game, 'r' for a registered
+         * result and 'd' for a deleted tournament. object is empty for 'd'. */
+        struct Change {
+            char kind;
+            std::string tournament;
+            std::string object;
+        };
+
+        // Subscribes this connection to the changes of other servers.
+        void listen();
+        /* Waits up to timeout milliseconds for changes and returns the ones
+         * that have arrived. Throws DatabaseError if the connection is lost. */
+        std::vector<Change> changes(int timeout);
+        // Empties the id caches shared by all connections to this database.
+        void forgetIds();
+
+        void begin() override;
+        void commit() override;
+        void rollback() override;
 
         // Operations on tournaments:
-        bool getTournament(pairing_server::Tournament *t);
-        int nextRound(const pairing_server::Identification *id);
-        std::vector<pairing_server::Player> tournamentPlayers(const pairing_server::Identification *id);
-        std::vector<pairing_server::Game> tournamentGames(const pairing_server::Identification *id);
-        pairing_server::Identification insertTournament(const pairing_server::Tournament *t);
+        bool getTournament(pairing_server::Tournament *t) override;
+        int nextRound(const pairing_server::Identification *id) override;
+        int unfinishedGames(const pairing_server::Identification *id) override;
+        std::vector<pairing_server::Player> tournamentPlayers(const pairing_server::Identification *id) override;
+        std::vector<pairing_server::Game> tournamentGames(const pairing_server::Identification *id) override;
+        pairing_server::Identification insertTournament(const pairing_server::Tournament *t) override;
 
         // Operations on players:
-        bool getPlayer(pairing_server::Player *p);
-        std::vector<pairing_server::Game> playerGames(const pairing_server::Identification *id);
-        pairing_server::Identification insertPlayer(const pairing_server::Player *p);
+        bool getPlayer(pairing_server::Player *p) override;
+        std::vector<pairing_server::Game> playerGames(const pairing_server::Identification *id) override;
+        pairing_server::Identification insertPlayer(const pairing_server::Player *p) override;
 
         // Operations on games:
-        bool getGame(pairing_server::Game *g);
-        pairing_server::Identification insertGame(const pairing_server::Game *g);
-        void registerResult(const pairing_server::Identification &gameId, pairing_server::Result result);
+        bool getGame(pairing_server::Game *g) override;
+        pairing_server::Identification insertGame(const pairing_server::Game *g) override;
+        void registerResult(const pairing_server::Identification &gameId, pairing_server::Result result) override;
+
+        // Used when moving tournaments between shards:
+        std::vector<pairing_server::Tournament> tournamentsBetween(const std::string &from, const std::string &to);
+        void deleteTournament(const pairing_server::Identification &id) override;
+
+        /* The shared bucket assignment of a set of shards, kept in the first
+         * one. Every server using the shards holds the lock shared for as
+         * long as it runs; a server moving buckets takes it exclusively,
+         * which only succeeds while no other server is using them. The lock
+         * belongs to the connection. */
+        void lockBucketsShared();
+        bool tryLockBuckets();
+        void unlockBuckets();
+        // The shard of every bucket, or nothing if none are recorded yet.
+        std::vector<uint16_t> buckets();
+        // Records buckets unless others already have.
+        void recordBuckets(const std::vector<uint16_t> &buckets);
+        void setBuckets(uint32_t first, uint32_t last, uint16_t shard);
 
     private:
+        /* Runs a write outside a transaction in one of its own when changes
+         * are notified, so that the write and its NOTIFY commit together. */
+        class SingleWrite {
+            public:
+                SingleWrite(Database &db) : db(db), active(notifyChanges && !db.inTransaction) {
+                    if(active)
+                        db.begin();
+                }
+                ~SingleWrite() {
+                    if(active) {
+                        try {
+                            db.rollback();
+                        }
+                        catch(DatabaseError &) {}
+                    }
+                }
+                void commit() {
+                    if(active) {
+                        active = false;
+                        db.commit();
+                    }
+                }
+
+            private:
+                Database &db;
+                bool active;
+        };
+
         const char *dbname = NULL;
         const char *user = NULL;
         const char *password = NULL;
         const char *host = NULL;
         PGconn *db = NULL;
+        IdCaches *ids = NULL;
+        bool bucketsPrepared = false;
+
+        /* Ids seen inside a transaction are only put in the shared caches
+         * once it commits. */
+        bool inTransaction = false;
+        std::vector<std::tuple<IdCache *, std::string, int32_t>> pendingIds;
+        std::vector<std::string> pendingChanges;
+
+        void remember(IdCache &cache, PGresult *res, int i, const char *uuidCol, const char *idCol);
+        void remember(IdCache &cache, const std::string &uuid, int32_t id);
+        void rememberGame(PGresult *res, int i);
+        void changed(char kind, const std::string &tournament, const std::string &object);
+        void sendChanges();
+        PGresult *executeById(const char *idStmt, const char *uuidStmt, IdCache &cache,
+                const pairing_server::Identification *id, int minRows = 0, int maxRows = -1);
+        const char *presetUuid(const pairing_server::Identification &id);
+        void prepareBuckets();
         void prepare(const char *name, const char *sql, int count);
         PGresult *execute(const char *stmt, int count, const char **values,
                 const int *lengths, const int *formats, int resultFormat,
@@ -65,13 +141,4 @@ class Database {
         void sqlDo(const char *sql);
 };
 
-class DatabaseError : public std::exception {
-    public:
-        DatabaseError(const char *dbmsg) : msg(dbmsg) {}
-        const char *what() const noexcept { return msg.c_str(); }
-
-    private:
-        std::string msg;
-};
-
 #endif
@@ -0,0 +1,61 @@
+#include "executor.h"
+
+TournamentExecutor::TournamentExecutor(unsigned threads) {
+    for(unsigned i = 0; i < threads; i++) {
+        workers.emplace_back([this] { work(); });
+    }
+}
+
+TournamentExecutor::~TournamentExecutor() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    ready.notify_all();
+    for(std::thread &t: workers) {
+        t.join();
+    }
+}
+
+void TournamentExecutor::submit(const std::string &tournament, std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        std::deque<std::function<void()>> &queue = queues[tournament];
+        queue.push_back(std::move(job));
+        // Otherwise the thread running the tournament's last change picks it up.
+        if(queue.size() > 1)
+            return;
+        runnable.push_back(tournament);
+    }
+    ready.notify_one();
+}
+
+/* The running change stays at the front of its queue, which keeps new ones
+ * from making the tournament runnable again until it's done. A tournament
+ * with more changes goes to the back of the line, so busy tournaments take
+ * turns with the others. */
+void TournamentExecutor::work() {
+    std::unique_lock<std::mutex> guard(lock);
+    for(;;) {
+        ready.wait(guard, [this] { return stopping || !runnable.empty(); });
+        if(runnable.empty())
+            return;
+        std::string tournament = std::move(runnable.front());
+        runnable.pop_front();
+        std::function<void()> job = std::move(queues[tournament].front());
+
+        guard.unlock();
+        job();
+        guard.lock();
+
+        auto it = queues.find(tournament);
+        it->second.pop_front();
+        if(it->second.empty()) {
+            queues.erase(it);
+        }
+        else {
+            runnable.push_back(tournament);
+            ready.notify_one();
+        }
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef _EXECUTOR_H
+#define _EXECUTOR_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/* Runs the changes to a tournament one at a time, in the order they arrive.
+ * Each tournament with changes waiting has its own queue, and a shared set of
+ * threads takes turns running the first change of each queue, so a
+ * tournament is only ever worked on by one thread while different
+ * tournaments proceed in parallel. A slow change only holds up its own
+ * tournament, as long as there are threads left for the others. This only
+ * orders the requests reaching this process; several servers writing the
+ * same tournament still rely on the database. */
+class TournamentExecutor {
+    public:
+        explicit TournamentExecutor(unsigned threads);
+        ~TournamentExecutor();
+
+        /* Runs func once the earlier changes to the tournament are done and
+         * waits for it. Its return value or exception is passed on to the
+         * caller. */
+        template <typename Func>
+        auto run(const std::string &tournament, Func func) -> decltype(func()) {
+            auto task = std::make_shared<std::packaged_task<decltype(func())()>>(std::move(func));
+            auto result = task->get_future();
+            submit(tournament, [task] { (*task)(); });
+            return result.get();
+        }
+
+    private:
+        std::mutex lock;
+        std::condition_variable ready;
+        /* The changes to each tournament, including the one running. A
+         * tournament is only here while its queue isn't empty. */
+        std::unordered_map<std::string, std::deque<std::function<void()>>> queues;
+        // Tournaments with changes waiting and none running, in turn.
+        std::deque<std::string> runnable;
+        bool stopping = false;
+        std::vector<std::thread> workers;
+
+        void submit(const std::string &tournament, std::function<void()> job);
+        void work();
+};
+
+#endif
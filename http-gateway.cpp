@@ -0,0 +1,418 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <google/protobuf/util/json_util.h>
+#include <iostream>
+#include <netdb.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "http-gateway.h"
+#include "uuid.h"
+
+using namespace pairing_server;
+
+/* Requests are GETs without bodies, so anything larger is refused. */
+static const size_t MAX_REQUEST = 16 * 1024;
+
+static const char *reason(int status) {
+    switch(status) {
+        case 200: return "OK";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 431: return "Request Header Fields Too Large";
+        case 503: return "Service Unavailable";
+        default:  return "Internal Server Error";
+    }
+}
+
+static bool fromBase64(const std::string &text, std::string *bytes) {
+    if(text.empty() || text.size() % 4 != 0)
+        return false;
+    std::string out(text.size() / 4 * 3, '\0');
+    int n = EVP_DecodeBlock((unsigned char *) &out[0], (const unsigned char *) text.data(), text.size());
+    if(n < 0)
+        return false;
+    // EVP_DecodeBlock() counts the padding as bytes.
+    size_t padding = text.size() - (text.find_last_not_of('=') + 1);
+    out.resize(n - std::min<size_t>(padding, 2));
+    *bytes = out;
+    return true;
+}
+
+/* The JSON printer gives bytes fields in base64, but URLs take UUIDs in hex,
+ * so the UUIDs of a response are rewritten in hex. Quotes within strings are
+ * escaped, so "uuid":" only matches the field. */
+static std::string hexUuids(const std::string &json) {
+    static const std::string key = "\"uuid\":\"";
+    std::string out;
+    size_t from = 0, at;
+    while((at = json.find(key, from)) != std::string::npos) {
+        size_t start = at + key.size(), end = json.find('"', start);
+        if(end == std::string::npos)
+            break;
+        out.append(json, from, start - from);
+        std::string bytes;
+        if(fromBase64(json.substr(start, end - start), &bytes))
+            out += toHex(bytes);
+        else
+            out.append(json, start, end - start);
+        from = end;
+    }
+    out.append(json, from, std::string::npos);
+    return out;
+}
+
+static std::string json(const google::protobuf::Message &m) {
+    google::protobuf::util::JsonPrintOptions options;
+    options.always_print_primitive_fields = true;
+    std::string out;
+    google::protobuf::util::MessageToJsonString(m, &out, options);
+    return hexUuids(out);
+}
+
+template<typename T>
+static std::string json(const std::vector<T> &messages) {
+    std::string out = "[";
+    for(size_t i = 0; i < messages.size(); i++) {
+        if(i > 0) out += ",";
+        out += json(messages[i]);
+    }
+    return out + "]";
+}
+
+static std::string error(const char *msg) {
+    return std::string("{\"error\":\"") + msg + "\"}";
+}
+
+/* Accepts the usual 8-4-4-4-12 form, or just the 32 hex digits. */
+static bool parseUuid(const std::string &text, std::string *uuid) {
+    std::string bytes;
+    if(!fromHex(text, &bytes) || bytes.size() != 16)
+        return false;
+    *uuid = bytes;
+    return true;
+}
+
+static std::string header(const std::string &head, const char *name) {
+    size_t len = strlen(name);
+    size_t pos = 0;
+    while((pos = head.find("\r\n", pos)) != std::string::npos) {
+        pos += 2;
+        if(strncasecmp(head.c_str() + pos, name, len) == 0 && head[pos + len] == ':') {
+            size_t start = head.find_first_not_of(" \t", pos + len + 1);
+            size_t end = head.find("\r\n", pos);
+            if(start == std::string::npos || start > end) return "";
+            return head.substr(start, end - start);
+        }
+    }
+    return "";
+}
+
+TournamentVersions::TournamentVersions() : bootId(newBootId()) {}
+
+uint64_t TournamentVersions::get(const std::string &tournament) {
+    std::shared_lock<std::shared_mutex> guard(lock);
+    auto it = versions.find(tournament);
+    return it == versions.end()? 0: it->second;
+}
+
+void TournamentVersions::bump(const std::string &tournament) {
+    std::unique_lock<std::shared_mutex> guard(lock);
+    versions[tournament]++;
+}
+
+void TournamentVersions::reset() {
+    std::string id = newBootId();
+    std::unique_lock<std::shared_mutex> guard(lock);
+    // Versions are kept, so a tag can't come back with other content.
+    bootId = id;
+}
+
+std::string TournamentVersions::boot() {
+    std::shared_lock<std::shared_mutex> guard(lock);
+    return bootId;
+}
+
+std::string TournamentVersions::newBootId() {
+    unsigned char buf[4];
+    if(RAND_bytes(&buf[0], 4) != 1)
+        throw std::runtime_error("Failed to generate boot id");
+    return toHex(std::string((const char *) &buf[0], 4));
+}
+
+HttpGateway::HttpGateway(Storage &(*db)(), TournamentVersions &versions,
+        AdmissionControl *admission) :
+    db(db), versions(versions), admission(admission) {}
+
+void HttpGateway::start(const char *address, const char *port, int threads) {
+    struct addrinfo hints, *addrs;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    int rc = getaddrinfo(address, port, &hints, &addrs);
+    if(rc != 0)
+        throw std::runtime_error(std::string("HTTP address: ") + gai_strerror(rc));
+
+    for(int i = 0; i < threads; i++) {
+        int fd = socket(addrs->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int one = 1;
+        if(fd < 0
+                || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0
+                || setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0
+                || bind(fd, addrs->ai_addr, addrs->ai_addrlen) < 0
+                || listen(fd, SOMAXCONN) < 0) {
+            std::string msg = std::string("HTTP listener: ") + strerror(errno);
+            if(fd >= 0) close(fd);
+            freeaddrinfo(addrs);
+            throw std::runtime_error(msg);
+        }
+        std::thread([this, fd] { loop(fd); }).detach();
+    }
+    freeaddrinfo(addrs);
+}
+
+void HttpGateway::loop(int listener) {
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = listener;
+    if(ep < 0 || epoll_ctl(ep, EPOLL_CTL_ADD, listener, &ev) < 0) {
+        std::cerr << "HTTP gateway: " << strerror(errno) << std::endl;
+        return;
+    }
+
+    std::unordered_map<int, Connection> connections;
+    struct epoll_event events[64];
+    for(;;) {
+        int n = epoll_wait(ep, &events[0], 64, -1);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            std::cerr << "HTTP gateway: " << strerror(errno) << std::endl;
+            return;
+        }
+
+        for(int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if(fd == listener) {
+                int client;
+                while((client = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                    ev.events = EPOLLIN;
+                    ev.data.fd = client;
+                    epoll_ctl(ep, EPOLL_CTL_ADD, client, &ev);
+                    connections[client] = Connection();
+                }
+                continue;
+            }
+
+            Connection &c = connections[fd];
+            bool ok = !(events[i].events & EPOLLERR);
+            if(ok && (events[i].events & (EPOLLIN | EPOLLHUP)))
+                ok = receive(fd, c);
+            if(ok)
+                ok = flush(fd, c);
+            if(!ok || (c.close && c.out.empty())) {
+                close(fd);
+                connections.erase(fd);
+                continue;
+            }
+            // Once closing, only wait for the rest of the output to drain.
+            uint32_t wanted = (c.close? 0: EPOLLIN) | (c.out.empty()? 0: EPOLLOUT);
+            if(wanted != c.events) {
+                c.events = ev.events = wanted;
+                ev.data.fd = fd;
+                epoll_ctl(ep, EPOLL_CTL_MOD, fd, &ev);
+            }
+        }
+    }
+}
+
+/* Reads what's available and answers every complete request in it. Returns
+ * false if the connection should be dropped right away. */
+bool HttpGateway::receive(int fd, Connection &c) {
+    char buf[4096];
+    bool eof = false;
+    for(;;) {
+        ssize_t got = read(fd, &buf[0], sizeof(buf));
+        if(got > 0) {
+            c.in.append(&buf[0], got);
+            continue;
+        }
+        if(got == 0) {
+            eof = true;
+            break;
+        }
+        if(errno == EINTR) continue;
+        if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+        return false;
+    }
+    // Requests sent before the client shut down its end still get answers.
+    process(c);
+    if(eof)
+        c.close = true;
+    return true;
+}
+
+bool HttpGateway::flush(int fd, Connection &c) {
+    while(!c.out.empty()) {
+        ssize_t sent = send(fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+        if(sent < 0) {
+            if(errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        c.out.erase(0, sent);
+    }
+    return true;
+}
+
+void HttpGateway::process(Connection &c) {
+    size_t end;
+    while(!c.close && (end = c.in.find("\r\n\r\n")) != std::string::npos) {
+        std::string head = c.in.substr(0, end);
+        c.in.erase(0, end + 4);
+
+        std::stringstream line(head.substr(0, head.find("\r\n")));
+        std::string method, path, version;
+        line >> method >> path >> version;
+        std::string connection = header(head, "Connection");
+        bool keepAlive = version == "HTTP/1.1"?
+            strcasecmp(connection.c_str(), "close") != 0:
+            strcasecmp(connection.c_str(), "keep-alive") == 0;
+
+        Response r;
+        if(method.empty() || path.empty() || version.compare(0, 5, "HTTP/") != 0) {
+            r = Response{400, error("Malformed request"), ""};
+            keepAlive = false;
+        }
+        else if(!header(head, "Content-Length").empty() || !header(head, "Transfer-Encoding").empty()) {
+            r = Response{400, error("Requests can't have a body"), ""};
+            keepAlive = false;
+        }
+        else if(method != "GET" && method != "HEAD") {
+            r = Response{405, error("Only GET is supported"), ""};
+        }
+        else {
+            r = route(path, header(head, "If-None-Match"));
+        }
+
+        std::stringstream out;
+        out << "HTTP/1.1 " << r.status << " " << reason(r.status) << "\r\n";
+        if(!r.etag.empty())
+            out << "ETag: " << r.etag << "\r\nCache-Control: no-cache\r\n";
+        if(r.status != 304)
+            out << "Content-Type: application/json\r\nContent-Length: " << r.body.size() << "\r\n";
+        out << "Connection: " << (keepAlive? "keep-alive": "close") << "\r\n\r\n";
+        if(r.status != 304 && method != "HEAD")
+            out << r.body;
+        c.out += out.str();
+        c.close = !keepAlive;
+    }
+
+    if(c.in.size() > MAX_REQUEST) {
+        c.out += "HTTP/1.1 431 Request Header Fields Too Large\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        c.in.clear();
+        c.close = true;
+    }
+}
+
+/* The version is read before the data, so an ETag may be older than the
+ * data it comes with but never newer. Where the owning tournament isn't known
+ * until the data has been read, no ETag is sent. */
+HttpGateway::Response HttpGateway::route(const std::string &target, const std::string &ifNoneMatch) {
+    std::string path = target.substr(0, target.find('?'));
+    std::vector<std::string> parts;
+    std::stringstream ss(path);
+    std::string part;
+    while(std::getline(ss, part, '/')) {
+        if(!part.empty()) parts.push_back(part);
+    }
+
+    Identification id;
+    std::string uuid;
+    if(parts.size() < 2 || parts.size() > 3 || !parseUuid(parts[1], &uuid))
+        return Response{404, error("No such resource"), ""};
+    id.set_uuid(uuid);
+    const std::string &kind = parts[0];
+    std::string sub = parts.size() == 3? parts[2]: "";
+
+    std::string tournament = kind == "tournaments"? uuid: owner(uuid);
+    std::string tag = tournament.empty()? "": etag(versions.get(tournament));
+    if(!tag.empty() && ifNoneMatch.find(tag) != std::string::npos)
+        return Response{304, "", tag};
+
+    // The routes with a sub-resource are the listings.
+    AdmissionControl::Ticket ticket;
+    if(admission && !admission->admit(sub.empty()? AdmissionControl::READ: AdmissionControl::LIST,
+                false, ticket))
+        return Response{503, error("Server overloaded, try again later"), ""};
+
+    try {
+        if(kind == "tournaments" && sub.empty()) {
+            Tournament t;
+            *(t.mutable_id()) = id;
+            if(!db().getTournament(&t))
+                return Response{404, error("No such tournament"), ""};
+            return Response{200, json(t), tag};
+        }
+        if(kind == "tournaments" && sub == "players")
+            return Response{200, json(db().tournamentPlayers(&id)), tag};
+        if(kind == "tournaments" && sub == "games")
+            return Response{200, json(db().tournamentGames(&id)), tag};
+
+        if(kind == "players" && (sub.empty() || sub == "games")) {
+            Player p;
+            if(sub.empty() || tournament.empty()) {
+                *(p.mutable_id()) = id;
+                if(!db().getPlayer(&p))
+                    return Response{404, error("No such player"), ""};
+                setOwner(uuid, p.tournament().id().uuid());
+            }
+            if(sub.empty())
+                return Response{200, json(p), tag};
+            return Response{200, json(db().playerGames(&id)), tag};
+        }
+
+        if(kind == "games" && sub.empty()) {
+            Game g;
+            *(g.mutable_id()) = id;
+            if(!db().getGame(&g))
+                return Response{404, error("No such game"), ""};
+            setOwner(uuid, g.tournament().id().uuid());
+            return Response{200, json(g), tag};
+        }
+    }
+    catch(DatabaseError &e) {
+        std::cerr << "Got DB exception (" << __FILE__ << ":" << __LINE__ << "): " << e.what() << std::endl;
+        return Response{500, error("Database error"), ""};
+    }
+    return Response{404, error("No such resource"), ""};
+}
+
+std::string HttpGateway::etag(uint64_t version) {
+    return "\"" + versions.boot() + "-" + std::to_string(version) + "\"";
+}
+
+std::string HttpGateway::owner(const std::string &uuid) {
+    std::lock_guard<std::mutex> guard(ownersLock);
+    auto it = owners.find(uuid);
+    return it == owners.end()? "": it->second;
+}
+
+void HttpGateway::setOwner(const std::string &uuid, const std::string &tournament) {
+    std::lock_guard<std::mutex> guard(ownersLock);
+    // Crude, but keeps the map bounded; entries are cheap to learn again.
+    if(owners.size() >= (1 << 20))
+        owners.clear();
+    owners[uuid] = tournament;
+}
@@ -0,0 +1,94 @@
+#ifndef _HTTP_GATEWAY_H
+#define _HTTP_GATEWAY_H
+
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <sys/epoll.h>
+#include <unordered_map>
+
+#include "admission.h"
+#include "storage.h"
+
+/* Per-tournament counters, bumped after every committed change to a
+ * tournament, its players or its games. The HTTP gateway builds its ETags
+ * from them. */
+class TournamentVersions {
+    public:
+        TournamentVersions();
+
+        uint64_t get(const std::string &tournament);
+        void bump(const std::string &tournament);
+        /* Invalidates every ETag handed out so far, for when changes may have
+         * been missed. */
+        void reset();
+        // Part of every ETag, so that a restart invalidates them all.
+        std::string boot();
+
+    private:
+        std::string bootId;
+
+        static std::string newBootId();
+        std::shared_mutex lock;
+        std::unordered_map<std::string, uint64_t> versions;
+};
+
+/* Read-only HTTP/JSON view of the PairingServer read operations:
+ *
+ *     GET /tournaments/<uuid>          GetTournament
+ *     GET /tournaments/<uuid>/players  GetPlayers
+ *     GET /tournaments/<uuid>/games    GetTournamentGames
+ *     GET /players/<uuid>              GetPlayer
+ *     GET /players/<uuid>/games        PlayerGames
+ *     GET /games/<uuid>                GetGame
+ *
+ * Messages are rendered with protobuf's JSON printer, except that UUIDs are
+ * given in hex, as in the URLs. Each worker thread
+ * runs its own epoll loop on its own SO_REUSEPORT listener and answers
+ * requests inline with its own storage connection, so a slow query only
+ * stalls the connections of one thread. Connections are kept alive, and
+ * responses carry an ETag so that unchanged data can be answered with 304
+ * without touching the storage. Requests that need the storage go through
+ * the server's admission control like the RPCs do, a listing as LIST and
+ * anything else as READ, and are answered with 503 when shed. */
+class HttpGateway {
+    public:
+        HttpGateway(Storage &(*db)(), TournamentVersions &versions,
+                AdmissionControl *admission = nullptr);
+
+        void start(const char *address, const char *port, int threads);
+
+    private:
+        struct Connection {
+            std::string in;
+            std::string out;
+            uint32_t events = EPOLLIN;
+            bool close = false;
+        };
+
+        struct Response {
+            int status;
+            std::string body;
+            std::string etag;
+        };
+
+        Storage &(*db)();
+        TournamentVersions &versions;
+        AdmissionControl *admission;
+
+        // Owning tournament of players and games seen so far.
+        std::mutex ownersLock;
+        std::unordered_map<std::string, std::string> owners;
+
+        void loop(int listener);
+        bool receive(int fd, Connection &c);
+        bool flush(int fd, Connection &c);
+        void process(Connection &c);
+        Response route(const std::string &path, const std::string &ifNoneMatch);
+        std::string etag(uint64_t version);
+        std::string owner(const std::string &uuid);
+        void setOwner(const std::string &uuid, const std::string &tournament);
+};
+
+#endif
@@ -0,0 +1,63 @@
+#include <algorithm>
+#include <cstring>
+
+#include "id-cache.h"
+
+size_t IdCache::UuidHash::operator()(const std::string &uuid) const {
+    size_t h = 0;
+    memcpy(&h, uuid.data(), std::min(sizeof(size_t), uuid.size()));
+    return h;
+}
+
+IdCache::IdCache(size_t capacity) : shardCapacity(capacity / SHARDS + 1) {}
+
+bool IdCache::get(const std::string &uuid, int32_t *id) {
+    Shard &s = shard(uuid);
+    std::lock_guard<std::mutex> guard(s.lock);
+    auto it = s.index.find(uuid);
+    if(it == s.index.end())
+        return false;
+    s.lru.splice(s.lru.begin(), s.lru, it->second);
+    *id = it->second->second;
+    return true;
+}
+
+void IdCache::put(const std::string &uuid, int32_t id) {
+    Shard &s = shard(uuid);
+    std::lock_guard<std::mutex> guard(s.lock);
+    auto it = s.index.find(uuid);
+    if(it != s.index.end()) {
+        it->second->second = id;
+        s.lru.splice(s.lru.begin(), s.lru, it->second);
+        return;
+    }
+    if(s.index.size() >= shardCapacity) {
+        s.index.erase(s.lru.back().first);
+        s.lru.pop_back();
+    }
+    s.lru.emplace_front(uuid, id);
+    s.index[uuid] = s.lru.begin();
+}
+
+void IdCache::erase(const std::string &uuid) {
+    Shard &s = shard(uuid);
+    std::lock_guard<std::mutex> guard(s.lock);
+    auto it = s.index.find(uuid);
+    if(it == s.index.end())
+        return;
+    s.lru.erase(it->second);
+    s.index.erase(it);
+}
+
+void IdCache::clear() {
+    for(Shard &s: shards) {
+        std::lock_guard<std::mutex> guard(s.lock);
+        s.index.clear();
+        s.lru.clear();
+    }
+}
+
+IdCache::Shard &IdCache::shard(const std::string &uuid) {
+    // The last byte is random too, and independent of what UuidHash uses.
+    return shards[uuid.empty()? 0: (unsigned char) uuid.back() % SHARDS];
+}
@@ -0,0 +1,52 @@
+#ifndef _ID_CACHE_H
+#define _ID_CACHE_H
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/* Bounded map from row UUIDs to their SERIAL ids, shared by the Database
+ * connections to one database so that hot statements can bind ids directly
+ * instead of probing the uuid indexes. Each shard has its own lock and evicts
+ * its least recently used entry when full.
+ *
+ * Rows are only deleted when their tournament moves to another shard or is
+ * archived with --archive-delete. Database::deleteTournament() evicts them,
+ * and with --notify other servers clear their caches when told of the
+ * deletion, so an entry stays correct once the transaction that created the
+ * row has committed. Ids from uncommitted transactions must not be put in
+ * the cache. */
+class IdCache {
+    public:
+        explicit IdCache(size_t capacity);
+
+        bool get(const std::string &uuid, int32_t *id);
+        void put(const std::string &uuid, int32_t id);
+        void erase(const std::string &uuid);
+        void clear();
+
+    private:
+        static const int SHARDS = 16;
+
+        // UUIDs are random, so the first bytes make a good enough hash.
+        struct UuidHash {
+            size_t operator()(const std::string &uuid) const;
+        };
+
+        typedef std::list<std::pair<std::string, int32_t>> Entries;
+
+        struct Shard {
+            std::mutex lock;
+            Entries lru;
+            std::unordered_map<std::string, Entries::iterator, UuidHash> index;
+        };
+
+        size_t shardCapacity;
+        Shard shards[SHARDS];
+
+        Shard &shard(const std::string &uuid);
+};
+
+#endif
@@ -0,0 +1,592 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "memory-storage.h"
+#include "uuid.h"
+
+using namespace pairing_server;
+
+static std::string frame(const LogRecord &record) {
+    std::string body;
+    if(!record.SerializeToString(&body))
+        throw DatabaseError("Failed to serialize log record");
+    uint32_t netLength = htonl(body.size());
+    return std::string((const char *) &netLength, sizeof(uint32_t)) + body;
+}
+
+static void writeAll(int fd, const std::string &data) {
+    const char *p = data.data();
+    size_t left = data.size();
+    while(left > 0) {
+        ssize_t written = ::write(fd, p, left);
+        if(written < 0) {
+            if(errno == EINTR) continue;
+            throw DatabaseError(std::string("Write to storage file failed: ") + strerror(errno));
+        }
+        p += written;
+        left -= written;
+    }
+    if(fdatasync(fd) < 0)
+        throw DatabaseError(std::string("Sync of storage file failed: ") + strerror(errno));
+}
+
+/* Makes renames and newly created files in a directory durable. */
+static void syncDirectory(const std::string &directory) {
+    int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0)
+        throw DatabaseError(std::string("Can't open storage directory: ") + strerror(errno));
+    int ret = fsync(fd);
+    int err = errno;
+    close(fd);
+    if(ret < 0)
+        throw DatabaseError(std::string("Sync of storage directory failed: ") + strerror(err));
+}
+
+MemoryStorage::MemoryStorage(const char *directory) :
+    directory(directory), writer(std::thread::id()) {}
+
+MemoryStorage::~MemoryStorage() {
+    if(walFd >= 0) {
+        close(walFd);
+        walFd = -1;
+    }
+}
+
+void MemoryStorage::open() {
+    if(mkdir(directory.c_str(), 0777) < 0 && errno != EEXIST)
+        throw DatabaseError(std::string("Can't create storage directory: ") + strerror(errno));
+
+    auto guard = writeLock();
+    load(directory + "/snapshot");
+    load(directory + "/wal");
+    undo.clear();
+
+    std::string wal = directory + "/wal";
+    walFd = ::open(wal.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    if(walFd < 0)
+        throw DatabaseError(std::string("Can't open write-ahead log: ") + strerror(errno));
+
+    /* Starting from a fresh snapshot also gets rid of any partially written
+     * record at the end of the log. */
+    writeSnapshot();
+}
+
+void MemoryStorage::snapshot() {
+    if(inTransaction())
+        throw DatabaseError("Can't snapshot inside a transaction");
+    auto guard = writeLock();
+    writeSnapshot();
+}
+
+void MemoryStorage::begin() {
+    if(inTransaction())
+        throw DatabaseError("Transaction already in progress");
+    lock.lock();
+    writer = std::this_thread::get_id();
+}
+
+void MemoryStorage::commit() {
+    if(!inTransaction())
+        throw DatabaseError("No transaction in progress");
+    try {
+        if(!pending.empty())
+            appendLog(pending);
+    }
+    catch(...) {
+        undoAll();
+        pending.clear();
+        release();
+        throw;
+    }
+    walRecords += undo.size();
+    undo.clear();
+    pending.clear();
+
+    if(walRecords >= SNAPSHOT_INTERVAL) {
+        /* The transaction is already durable in the log, so a failed
+         * snapshot shouldn't fail the commit. */
+        try {
+            writeSnapshot();
+        }
+        catch(DatabaseError &e) {
+            std::cerr << "Snapshot failed: " << e.what() << std::endl;
+        }
+    }
+    release();
+}
+
+void MemoryStorage::rollback() {
+    if(!inTransaction())
+        throw DatabaseError("No transaction in progress");
+    undoAll();
+    pending.clear();
+    release();
+}
+
+bool MemoryStorage::getTournament(Tournament *t) {
+    auto guard = readLock();
+    uint32_t row = find(tournamentIndex, t->id().uuid());
+    if(row == NO_ROW)
+        return false;
+    tournamentFromRow(*t, row);
+    return true;
+}
+
+int MemoryStorage::nextRound(const Identification *id) {
+    auto guard = readLock();
+    uint32_t row = find(tournamentIndex, id->uuid());
+    return row == NO_ROW? 1: tournaments[row].lastRound + 1;
+}
+
+int MemoryStorage::unfinishedGames(const Identification *id) {
+    auto guard = readLock();
+    uint32_t row = find(tournamentIndex, id->uuid());
+    return row == NO_ROW? 0: tournaments[row].unfinished;
+}
+
+std::vector<Player> MemoryStorage::tournamentPlayers(const Identification *id) {
+    auto guard = readLock();
+    uint32_t row = find(tournamentIndex, id->uuid());
+    if(row == NO_ROW)
+        return std::vector<Player>();
+    const std::vector<uint32_t> &rows = tournaments[row].players;
+    std::vector<Player> vec(rows.size());
+    for(size_t i = 0; i < rows.size(); i++) {
+        // Pairing needs the flags, like the players query in Database returns.
+        playerFromRow(vec[i], rows[i], false);
+        vec[i].set_withdrawn(players[rows[i]].withdrawn);
+        vec[i].set_expelled(players[rows[i]].expelled);
+    }
+    return vec;
+}
+
+std::vector<Game> MemoryStorage::tournamentGames(const Identification *id) {
+    auto guard = readLock();
+    uint32_t row = find(tournamentIndex, id->uuid());
+    if(row == NO_ROW)
+        return std::vector<Game>();
+    const std::vector<uint32_t> &rows = tournaments[row].games;
+    std::vector<Game> vec(rows.size());
+    for(size_t i = 0; i < rows.size(); i++) {
+        gameFromRow(vec[i], rows[i], false);
+    }
+    return vec;
+}
+
+Identification MemoryStorage::insertTournament(const Tournament *t) {
+    LogRecord record;
+    Tournament *rec = record.mutable_tournament();
+    *(rec->mutable_id()) = newId(t->id());
+    rec->set_name(t->name());
+    rec->set_rounds(t->rounds());
+    write(record);
+    return rec->id();
+}
+
+bool MemoryStorage::getPlayer(Player *p) {
+    auto guard = readLock();
+    uint32_t row = find(playerIndex, p->id().uuid());
+    if(row == NO_ROW)
+        return false;
+    playerFromRow(*p, row, true);
+    return true;
+}
+
+std::vector<Game> MemoryStorage::playerGames(const Identification *id) {
+    auto guard = readLock();
+    uint32_t row = find(playerIndex, id->uuid());
+    if(row == NO_ROW)
+        return std::vector<Game>();
+    std::vector<uint32_t> rows = players[row].games;
+    std::stable_sort(rows.begin(), rows.end(), [&](uint32_t a, uint32_t b) {
+            return games[a].round < games[b].round; });
+    std::vector<Game> vec(rows.size());
+    for(size_t i = 0; i < rows.size(); i++) {
+        gameFromRow(vec[i], rows[i], false);
+    }
+    return vec;
+}
+
+Identification MemoryStorage::insertPlayer(const Player *p) {
+    LogRecord record;
+    Player *rec = record.mutable_player();
+    *(rec->mutable_id()) = newId(p->id());
+    rec->set_name(p->name());
+    rec->set_rating(p->rating());
+    rec->set_withdrawn(p->withdrawn());
+    rec->set_expelled(p->expelled());
+    rec->mutable_tournament()->mutable_id()->set_uuid(p->tournament().id().uuid());
+    write(record);
+    return rec->id();
+}
+
+bool MemoryStorage::getGame(Game *g) {
+    auto guard = readLock();
+    uint32_t row = find(gameIndex, g->id().uuid());
+    if(row == NO_ROW)
+        return false;
+    gameFromRow(*g, row, true);
+    return true;
+}
+
+Identification MemoryStorage::insertGame(const Game *g) {
+    LogRecord record;
+    Game *rec = record.mutable_game();
+    *(rec->mutable_id()) = newId(g->id());
+    rec->mutable_tournament()->mutable_id()->set_uuid(g->tournament().id().uuid());
+    rec->mutable_white()->mutable_id()->set_uuid(g->white().id().uuid());
+    if(g->has_black())
+        rec->mutable_black()->mutable_id()->set_uuid(g->black().id().uuid());
+    rec->set_round(g->round());
+    rec->set_result(g->result());
+    write(record);
+    return rec->id();
+}
+
+void MemoryStorage::registerResult(const Identification &gameId, Result result) {
+    LogRecord record;
+    record.mutable_result()->set_game(gameId.uuid());
+    record.mutable_result()->set_result(result);
+    write(record);
+}
+
+/* Private helper methods: */
+std::shared_lock<std::shared_mutex> MemoryStorage::readLock() {
+    if(inTransaction())
+        return std::shared_lock<std::shared_mutex>();
+    return std::shared_lock<std::shared_mutex>(lock);
+}
+
+std::unique_lock<std::shared_mutex> MemoryStorage::writeLock() {
+    if(inTransaction())
+        return std::unique_lock<std::shared_mutex>();
+    return std::unique_lock<std::shared_mutex>(lock);
+}
+
+bool MemoryStorage::inTransaction() {
+    return writer.load() == std::this_thread::get_id();
+}
+
+void MemoryStorage::release() {
+    writer = std::thread::id();
+    lock.unlock();
+}
+
+uint32_t MemoryStorage::find(const std::unordered_map<std::string, uint32_t> &index, const std::string &uuid) {
+    auto it = index.find(uuid);
+    return it == index.end()? NO_ROW: it->second;
+}
+
+void MemoryStorage::tournamentFromRow(Tournament &t, uint32_t row) {
+    const TournamentRow &r = tournaments[row];
+    t.mutable_id()->set_uuid(r.uuid);
+    t.set_name(r.name);
+    t.set_rounds(r.rounds);
+}
+
+void MemoryStorage::playerFromRow(Player &p, uint32_t row, bool full) {
+    const PlayerRow &r = players[row];
+    p.mutable_id()->set_uuid(r.uuid);
+    p.set_name(r.name);
+    p.set_rating(r.rating);
+    if(full) {
+        p.set_withdrawn(r.withdrawn);
+        p.set_expelled(r.expelled);
+        tournamentFromRow(*(p.mutable_tournament()), r.tournament);
+    }
+}
+
+void MemoryStorage::gameFromRow(Game &g, uint32_t row, bool full) {
+    const GameRow &r = games[row];
+    g.mutable_id()->set_uuid(r.uuid);
+    g.set_result(r.result);
+    g.set_round(r.round);
+    playerFromRow(*(g.mutable_white()), r.white, false);
+    if(r.black != NO_ROW)
+        playerFromRow(*(g.mutable_black()), r.black, false);
+
+    // Single games carry their tournament, like the get_game query in Database.
+    if(full) {
+        tournamentFromRow(*(g.mutable_tournament()), r.tournament);
+        *(g.mutable_white()->mutable_tournament()) = g.tournament();
+        if(g.has_black())
+            *(g.mutable_black()->mutable_tournament()) = g.tournament();
+    }
+}
+
+Identification MemoryStorage::newId(const Identification &preset) {
+    Identification id;
+    if(preset.uuid().size() == 16) {
+        id.set_uuid(preset.uuid());
+        return id;
+    }
+
+    id.set_uuid(randomUuid());
+    return id;
+}
+
+/* Applies a change and makes it durable. Inside a transaction the log record
+ * is only buffered, and written out by commit(). */
+void MemoryStorage::write(const LogRecord &record) {
+    std::string data = frame(record);
+    auto guard = writeLock();
+    apply(record, false);
+    if(inTransaction()) {
+        pending += data;
+        return;
+    }
+
+    try {
+        appendLog(data);
+    }
+    catch(...) {
+        undoAll();
+        throw;
+    }
+    undo.clear();
+    if(++walRecords >= SNAPSHOT_INTERVAL) {
+        // The record is durable already, as in commit().
+        try {
+            writeSnapshot();
+        }
+        catch(DatabaseError &e) {
+            std::cerr << "Snapshot failed: " << e.what() << std::endl;
+        }
+    }
+}
+
+/* Appends records to the log. A write that fails partway is cut off again,
+ * so that later records don't end up behind a half-written one, which load()
+ * would read as the rest of it. */
+void MemoryStorage::appendLog(const std::string &data) {
+    struct stat st;
+    if(fstat(walFd, &st) < 0)
+        throw DatabaseError(std::string("Can't stat write-ahead log: ") + strerror(errno));
+    try {
+        writeAll(walFd, data);
+    }
+    catch(...) {
+        if(ftruncate(walFd, st.st_size) < 0)
+            std::cerr << "Can't truncate write-ahead log after a failed write: "
+                << strerror(errno) << std::endl;
+        throw;
+    }
+}
+
+/* Applies a log record to the tables. When replaying, records for rows that
+ * already exist are skipped, since a crash between writing a snapshot and
+ * truncating the log leaves the same records in both. */
+void MemoryStorage::apply(const LogRecord &record, bool replay) {
+    switch(record.record_case()) {
+        case LogRecord::kTournament: {
+            const Tournament &t = record.tournament();
+            if(tournamentIndex.count(t.id().uuid())) {
+                if(replay) return;
+                throw DatabaseError("Duplicate tournament UUID");
+            }
+            uint32_t row = tournaments.size();
+            tournaments.push_back(TournamentRow{t.id().uuid(), t.name(), t.rounds(), 0, 0, {}, {}});
+            tournamentIndex[t.id().uuid()] = row;
+            undo.push_back(Undo{record.record_case(), row, 0, NONE});
+            break;
+        }
+
+        case LogRecord::kPlayer: {
+            const Player &p = record.player();
+            if(playerIndex.count(p.id().uuid())) {
+                if(replay) return;
+                throw DatabaseError("Duplicate player UUID");
+            }
+            uint32_t tournament = find(tournamentIndex, p.tournament().id().uuid());
+            if(tournament == NO_ROW)
+                throw DatabaseError("No such tournament");
+            for(uint32_t other: tournaments[tournament].players) {
+                if(players[other].name == p.name())
+                    throw DatabaseError("Duplicate player name in tournament");
+            }
+            uint32_t row = players.size();
+            players.push_back(PlayerRow{p.id().uuid(), p.name(), tournament,
+                    p.rating(), p.withdrawn(), p.expelled(), {}});
+            playerIndex[p.id().uuid()] = row;
+            tournaments[tournament].players.push_back(row);
+            undo.push_back(Undo{record.record_case(), row, 0, NONE});
+            break;
+        }
+
+        case LogRecord::kGame: {
+            const Game &g = record.game();
+            if(gameIndex.count(g.id().uuid())) {
+                if(replay) return;
+                throw DatabaseError("Duplicate game UUID");
+            }
+            uint32_t tournament = find(tournamentIndex, g.tournament().id().uuid());
+            uint32_t white = find(playerIndex, g.white().id().uuid());
+            uint32_t black = g.has_black()? find(playerIndex, g.black().id().uuid()): NO_ROW;
+            if(tournament == NO_ROW || white == NO_ROW || (g.has_black() && black == NO_ROW))
+                throw DatabaseError("No such tournament or player");
+            uint32_t row = games.size();
+            TournamentRow &t = tournaments[tournament];
+            undo.push_back(Undo{record.record_case(), row, t.lastRound, NONE});
+            games.push_back(GameRow{g.id().uuid(), tournament, g.round(), white, black, g.result()});
+            gameIndex[g.id().uuid()] = row;
+            t.games.push_back(row);
+            t.lastRound = std::max(t.lastRound, g.round());
+            if(black != NO_ROW && g.result() == NONE)
+                t.unfinished++;
+            players[white].games.push_back(row);
+            if(black != NO_ROW)
+                players[black].games.push_back(row);
+            break;
+        }
+
+        case LogRecord::kResult: {
+            uint32_t row = find(gameIndex, record.result().game());
+            if(row == NO_ROW)
+                throw DatabaseError("No such game");
+            undo.push_back(Undo{record.record_case(), row, 0, games[row].result});
+            setResult(row, record.result().result());
+            break;
+        }
+
+        default:
+            throw DatabaseError("Unknown log record");
+    }
+}
+
+void MemoryStorage::setResult(uint32_t row, Result result) {
+    GameRow &g = games[row];
+    if(g.black != NO_ROW) {
+        uint32_t &unfinished = tournaments[g.tournament].unfinished;
+        unfinished += (result == NONE) - (g.result == NONE);
+    }
+    g.result = result;
+}
+
+/* Rows are only ever appended, and the exclusive lock is held while undo
+ * entries accumulate, so undoing an insert is always a pop_back. */
+void MemoryStorage::undoAll() {
+    for(auto it = undo.rbegin(); it != undo.rend(); it++) {
+        switch(it->kind) {
+            case LogRecord::kTournament:
+                tournamentIndex.erase(tournaments.back().uuid);
+                tournaments.pop_back();
+                break;
+
+            case LogRecord::kPlayer: {
+                const PlayerRow &p = players.back();
+                tournaments[p.tournament].players.pop_back();
+                playerIndex.erase(p.uuid);
+                players.pop_back();
+                break;
+            }
+
+            case LogRecord::kGame: {
+                const GameRow &g = games.back();
+                TournamentRow &t = tournaments[g.tournament];
+                t.games.pop_back();
+                t.lastRound = it->lastRound;
+                if(g.black != NO_ROW && g.result == NONE)
+                    t.unfinished--;
+                players[g.white].games.pop_back();
+                if(g.black != NO_ROW)
+                    players[g.black].games.pop_back();
+                gameIndex.erase(g.uuid);
+                games.pop_back();
+                break;
+            }
+
+            case LogRecord::kResult:
+                setResult(it->row, it->result);
+                break;
+
+            default:
+                break;
+        }
+    }
+    undo.clear();
+}
+
+void MemoryStorage::load(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    if(!in)
+        return;
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    size_t pos = 0;
+    LogRecord record;
+    while(pos + sizeof(uint32_t) <= data.size()) {
+        uint32_t length = ntohl(*(uint32_t *) &data[pos]);
+        pos += sizeof(uint32_t);
+        // A short record at the end is a write that didn't complete.
+        if(pos + length > data.size())
+            break;
+        if(!record.ParseFromArray(&data[pos], length))
+            throw DatabaseError("Corrupt record in " + path);
+        apply(record, true);
+        pos += length;
+    }
+}
+
+void MemoryStorage::writeSnapshot() {
+    std::string data;
+    LogRecord record;
+    for(const TournamentRow &t: tournaments) {
+        Tournament *rec = record.mutable_tournament();
+        rec->mutable_id()->set_uuid(t.uuid);
+        rec->set_name(t.name);
+        rec->set_rounds(t.rounds);
+        data += frame(record);
+    }
+    for(const PlayerRow &p: players) {
+        Player *rec = record.mutable_player();
+        rec->mutable_id()->set_uuid(p.uuid);
+        rec->set_name(p.name);
+        rec->set_rating(p.rating);
+        rec->set_withdrawn(p.withdrawn);
+        rec->set_expelled(p.expelled);
+        rec->mutable_tournament()->mutable_id()->set_uuid(tournaments[p.tournament].uuid);
+        data += frame(record);
+    }
+    for(const GameRow &g: games) {
+        Game *rec = record.mutable_game();
+        rec->Clear();
+        rec->mutable_id()->set_uuid(g.uuid);
+        rec->mutable_tournament()->mutable_id()->set_uuid(tournaments[g.tournament].uuid);
+        rec->mutable_white()->mutable_id()->set_uuid(players[g.white].uuid);
+        if(g.black != NO_ROW)
+            rec->mutable_black()->mutable_id()->set_uuid(players[g.black].uuid);
+        rec->set_round(g.round);
+        rec->set_result(g.result);
+        data += frame(record);
+    }
+
+    std::string path = directory + "/snapshot";
+    std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if(fd < 0)
+        throw DatabaseError(std::string("Can't open snapshot: ") + strerror(errno));
+    try {
+        writeAll(fd, data);
+    }
+    catch(...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+    if(rename(tmp.c_str(), path.c_str()) < 0)
+        throw DatabaseError(std::string("Can't replace snapshot: ") + strerror(errno));
+    /* The log may only be emptied once the new snapshot is sure to be the
+     * one found after a crash. */
+    syncDirectory(directory);
+    if(ftruncate(walFd, 0) < 0)
+        throw DatabaseError(std::string("Can't truncate write-ahead log: ") + strerror(errno));
+    walRecords = 0;
+}
@@ -0,0 +1,135 @@
+#ifndef _MEMORY_STORAGE_H
+#define _MEMORY_STORAGE_H
+
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "storage.h"
+#include "storage.pb.h"
+
+/* In-process storage engine. Tournaments, players and games live in flat
+ * tables indexed by row number, with hash indexes from UUID to row. Every
+ * change is appended to a write-ahead log before it becomes visible outside
+ * its transaction, and the log is periodically folded into a snapshot.
+ *
+ * A single MemoryStorage is shared by all server threads. Reads take a shared
+ * lock; a transaction holds the exclusive lock from begin() until commit() or
+ * rollback(), so transactions are serialized. */
+class MemoryStorage : public Storage {
+    public:
+        explicit MemoryStorage(const char *directory);
+        ~MemoryStorage();
+
+        /* Loads the snapshot and log from the directory, then writes a fresh
+         * snapshot. */
+        void open();
+        void snapshot();
+
+        void begin() override;
+        void commit() override;
+        void rollback() override;
+
+        // Operations on tournaments:
+        bool getTournament(pairing_server::Tournament *t) override;
+        int nextRound(const pairing_server::Identification *id) override;
+        int unfinishedGames(const pairing_server::Identification *id) override;
+        std::vector<pairing_server::Player> tournamentPlayers(const pairing_server::Identification *id) override;
+        std::vector<pairing_server::Game> tournamentGames(const pairing_server::Identification *id) override;
+        pairing_server::Identification insertTournament(const pairing_server::Tournament *t) override;
+
+        // Operations on players:
+        bool getPlayer(pairing_server::Player *p) override;
+        std::vector<pairing_server::Game> playerGames(const pairing_server::Identification *id) override;
+        pairing_server::Identification insertPlayer(const pairing_server::Player *p) override;
+
+        // Operations on games:
+        bool getGame(pairing_server::Game *g) override;
+        pairing_server::Identification insertGame(const pairing_server::Game *g) override;
+        void registerResult(const pairing_server::Identification &gameId, pairing_server::Result result) override;
+
+    private:
+        static const uint32_t NO_ROW = UINT32_MAX;
+        /* Once the log holds this many records, commits fold it into a new
+         * snapshot. */
+        static const uint32_t SNAPSHOT_INTERVAL = 1 << 16;
+
+        struct TournamentRow {
+            std::string uuid;
+            std::string name;
+            uint32_t rounds;
+            uint32_t lastRound;
+            uint32_t unfinished; // Games with black and no result.
+            std::vector<uint32_t> players;
+            std::vector<uint32_t> games;
+        };
+
+        struct PlayerRow {
+            std::string uuid;
+            std::string name;
+            uint32_t tournament;
+            uint32_t rating;
+            bool withdrawn;
+            bool expelled;
+            std::vector<uint32_t> games;
+        };
+
+        struct GameRow {
+            std::string uuid;
+            uint32_t tournament;
+            uint32_t round;
+            uint32_t white;
+            uint32_t black;
+            pairing_server::Result result;
+        };
+
+        /* Enough information to undo a single change made inside a
+         * transaction. */
+        struct Undo {
+            pairing_server::LogRecord::RecordCase kind;
+            uint32_t row;
+            uint32_t lastRound;
+            pairing_server::Result result;
+        };
+
+        std::string directory;
+        int walFd = -1;
+        uint32_t walRecords = 0;
+
+        std::vector<TournamentRow> tournaments;
+        std::vector<PlayerRow> players;
+        std::vector<GameRow> games;
+        std::unordered_map<std::string, uint32_t> tournamentIndex;
+        std::unordered_map<std::string, uint32_t> playerIndex;
+        std::unordered_map<std::string, uint32_t> gameIndex;
+
+        std::shared_mutex lock;
+        std::atomic<std::thread::id> writer;
+        std::string pending;
+        std::vector<Undo> undo;
+
+        std::shared_lock<std::shared_mutex> readLock();
+        std::unique_lock<std::shared_mutex> writeLock();
+        bool inTransaction();
+
+        uint32_t find(const std::unordered_map<std::string, uint32_t> &index, const std::string &uuid);
+        void tournamentFromRow(pairing_server::Tournament &t, uint32_t row);
+        void playerFromRow(pairing_server::Player &p, uint32_t row, bool full);
+        void gameFromRow(pairing_server::Game &g, uint32_t row, bool full);
+        pairing_server::Identification newId(const pairing_server::Identification &preset);
+
+        void write(const pairing_server::LogRecord &record);
+        void appendLog(const std::string &data);
+        void apply(const pairing_server::LogRecord &record, bool replay);
+        void setResult(uint32_t row, pairing_server::Result result);
+        void undoAll();
+        void release();
+        void load(const std::string &path);
+        void writeSnapshot();
+};
+
+#endif
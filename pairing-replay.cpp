@@ -0,0 +1,122 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <string>
+#include <vector>
+
+#include "args.h"
+#include "capture.pb.h"
+#include "pairing.h"
+
+/* Reruns pairings captured by pairing-server --capture and reports how long
+ * each stage takes: translating the stored tournament into bbpPairings'
+ * structures and the matching itself. With --repeat, every stage is run that
+ * many times and the fastest run is reported, which also makes the process
+ * long-lived enough to be worth attaching a profiler to. The pairings are
+ * compared with the ones the server produced. */
+
+using namespace pairing_server;
+
+struct Timing {
+    double buildMs = 1e300;
+    double matchMs = 1e300;
+};
+
+bool samePairings(const std::vector<Game> &a, const std::vector<Game> &b) {
+    if(a.size() != b.size())
+        return false;
+    for(size_t i = 0; i < a.size(); i++) {
+        if(a[i].white().id().uuid() != b[i].white().id().uuid()
+                || a[i].has_black() != b[i].has_black()
+                || a[i].black().id().uuid() != b[i].black().id().uuid())
+            return false;
+    }
+    return true;
+}
+
+/* The same steps as pairRound(), timed separately. */
+std::vector<Game> replay(const PairingInput &input, Timing &timing) {
+    typedef std::chrono::steady_clock clock;
+    std::vector<Player> players(input.players().begin(), input.players().end());
+    std::vector<Game> games(input.games().begin(), input.games().end());
+
+    auto start = clock::now();
+    tournament::Tournament bbp = bbpTournament(input.tournament(), input.round(), players, games);
+    auto built = clock::now();
+    std::list<swisssystems::Pairing> pairs = dutchMatching(std::move(bbp));
+    auto matched = clock::now();
+
+    timing.buildMs = std::min(timing.buildMs,
+            std::chrono::duration<double, std::milli>(built - start).count());
+    timing.matchMs = std::min(timing.matchMs,
+            std::chrono::duration<double, std::milli>(matched - built).count());
+
+    return pairingsToGames(input.tournament(), input.round(), players, pairs);
+}
+
+int main(int argc, const char **argv) {
+    try {
+        unsigned repeat = 1;
+        std::vector<const char *> files;
+        for(int i = 1; i < argc; i++) {
+            std::string arg(argv[i]);
+            if(arg == "--help" || arg == "-h") {
+                std::cout << "Usage: pairing-replay [--repeat N] FILE...\n";
+                return 0;
+            }
+            else if(arg == "--repeat" || arg == "-r") { repeat = std::stoul(getArg(argv, ++i, argc, "repeat")); }
+            else if(arg.size() > 1 && arg[0] == '-') {
+                throw ArgError(std::string("Unknown option ") + arg + ".\n");
+            }
+            else {
+                files.push_back(argv[i]);
+            }
+        }
+        if(files.empty())
+            throw ArgError("No capture files given.\n");
+
+        int status = 0;
+        std::cout << "file,players,games,round,build_ms,match_ms,captured_ms,boards,same\n";
+        for(const char *file: files) {
+            std::ifstream in(file, std::ios::binary);
+            PairingInput input;
+            if(!in || !input.ParseFromIstream(&in))
+                throw ArgError(std::string("Can't read capture ") + file + ".\n");
+
+            Timing timing;
+            std::vector<Game> pairings;
+            std::string error;
+            for(unsigned i = 0; i < std::max(repeat, 1u); i++) {
+                try {
+                    pairings = replay(input, timing);
+                }
+                catch(const PairingError &e) {
+                    error = e.what();
+                    break;
+                }
+            }
+
+            std::vector<Game> captured(input.pairings().begin(), input.pairings().end());
+            bool same = error.empty()? samePairings(pairings, captured): error == input.error();
+            if(!same)
+                status = 2;
+            std::cout << file << ',' << input.players_size() << ',' << input.games_size() << ','
+                << input.round() << ',';
+            if(error.empty())
+                std::cout << timing.buildMs << ',' << timing.matchMs << ',';
+            else
+                std::cout << ",,";
+            std::cout << input.pair_us() / 1000.0 << ',' << pairings.size() << ','
+                << (same? "yes": "no") << '\n';
+            if(!error.empty())
+                std::cerr << file << ": " << error << std::endl;
+        }
+        return status;
+    }
+    catch(const std::exception &e) {
+        std::cerr << e.what();
+        return 1;
+    }
+}
@@ -1,16 +1,28 @@
+#include <chrono>
 #include <exception>
+#include <fstream>
 #include <grpcpp/security/server_credentials.h>
 #include <grpcpp/server.h>
 #include <grpcpp/server_builder.h>
 #include <iostream>
 #include <mutex>
 #include <openssl/hmac.h>
+#include <signal.h>
 #include <string>
+#include <thread>
 
-#include <swisssystems/common.h>
-#include <tournament/tournament.h>
-
+#include "admission.h"
+#include "args.h"
+#include "archive.h"
+#include "capture.pb.h"
+#include "change-listener.h"
 #include "database.h"
+#include "executor.h"
+#include "http-gateway.h"
+#include "memory-storage.h"
+#include "pairing.h"
+#include "sharded-storage.h"
+#include "uuid.h"
 #include "service.grpc.pb.h"
 
 using namespace grpc;
@@ -19,9 +31,27 @@ using namespace pairing_server;
 static const char *dbname;
 static const char *dbuser;
 static const char *dbpass;
+static const char *memoryDir;
+static MemoryStorage *memoryStorage;
+static const char *shardFile;
+static ShardMap *shardMap;
+static const char *captureDir;
+static double captureSlowerMs;
+static ArchiveStore *archiveStore;
+static bool archiveDelete;
 static thread_local Database _db;
 static thread_local bool _db_done = false;
-static Database &db() {
+static thread_local std::unique_ptr<ShardedStorage> _sharded;
+static thread_local std::unique_ptr<ArchivedStorage> _archived;
+static Storage &engine() {
+    // The in-process engine is shared by all threads.
+    if(memoryStorage)
+        return *memoryStorage;
+    if(shardMap) {
+        if(!_sharded)
+            _sharded.reset(new ShardedStorage(*shardMap));
+        return *_sharded;
+    }
     if(!_db_done) {
         _db = Database(dbname, dbuser, dbpass);
         _db.connect();
@@ -30,9 +60,64 @@ static Database &db() {
     return _db;
 }
 
+static Storage &db() {
+    // Finished tournaments are read from their archive, if there is one.
+    if(archiveStore) {
+        if(!_archived)
+            _archived.reset(new ArchivedStorage(*archiveStore, engine()));
+        return *_archived;
+    }
+    return engine();
+}
+
+/* Writes the input of a pairing that took at least --capture-slower-than
+ * milliseconds, or failed, to the --capture directory. Failing to write it
+ * doesn't fail the request. */
+static void capture(const Tournament &t, uint32_t round, const std::vector<Player> &players,
+        const std::vector<Game> &games, const std::vector<Game> *pairings, const char *error,
+        std::chrono::steady_clock::time_point start) {
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    if(!captureDir || (!error && elapsed < std::chrono::duration<double, std::milli>(captureSlowerMs)))
+        return;
+
+    PairingInput input;
+    *(input.mutable_tournament()) = t;
+    input.set_round(round);
+    for(const Player &p: players)
+        *(input.add_players()) = p;
+    for(const Game &g: games)
+        *(input.add_games()) = g;
+    if(pairings) {
+        for(const Game &g: *pairings)
+            *(input.add_pairings()) = g;
+    }
+    if(error)
+        input.set_error(error);
+    input.set_pair_us(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+    input.set_captured_at(std::chrono::duration_cast<std::chrono::seconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count());
+
+    // The random part keeps captures made within the same second apart.
+    std::string path = std::string(captureDir) + "/" + toHex(t.id().uuid()) + "-" + std::to_string(round) + "-"
+        + std::to_string(input.captured_at()) + "-" + toHex(randomUuid().substr(0, 4)) + ".pairing";
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary);
+        if(!out || !input.SerializeToOstream(&out)) {
+            std::cerr << "Can't write pairing capture " << tmp << std::endl;
+            return;
+        }
+    }
+    if(rename(tmp.c_str(), path.c_str()) != 0)
+        std::cerr << "Can't write pairing capture " << path << std::endl;
+}
+
 class PairingServerImpl final : public PairingServer::Service {
     public:
-        explicit PairingServerImpl(const char *secret) : secret(std::string(secret)) {}
+        PairingServerImpl(const char *secret, TournamentVersions &versions,
+                TournamentExecutor *executor, AdmissionControl *admission) :
+            secret(std::string(secret)), versions(versions), executor(executor),
+            admission(admission) {}
 
         /* Generalized status creation:
          * Status(StatusCode code)
@@ -65,8 +150,14 @@ class PairingServerImpl final : public PairingServer::Service {
                 if(status.error_code() != StatusCode::OK) return status; })
         #define COMPLETE(obj, type) if(!complete(obj)) \
             return Status(StatusCode::INVALID_ARGUMENT, "Incomplete " type ".")
+        #define ADMITTED(cls, priority) AdmissionControl::Ticket ticket; \
+            if(!admitted(ctx, AdmissionControl::cls, priority, ticket)) \
+                return Status(StatusCode::RESOURCE_EXHAUSTED, "Server overloaded, try again later")
         #define HANDLER_PROLOGUE try {
         #define HANDLER_EPILOGUE } \
+                                 catch(ArchivedError &e) { \
+                                     return Status(StatusCode::FAILED_PRECONDITION, e.what()); \
+                                 } \
                                  catch(DatabaseError e) { \
                                      std::cerr << "Got DB exception (" << __FILE__ << ":" << __LINE__ << "): " << e.what(); \
                                      return Status(StatusCode::INTERNAL, "Database error", e.what()); \
@@ -80,6 +171,7 @@ class PairingServerImpl final : public PairingServer::Service {
         Status GetTournament(ServerContext *ctx, const Identification *req, Tournament *resp) override {
             HANDLER_PROLOGUE
             IDENTIFIED(*req, "tournament");
+            ADMITTED(READ, false);
             /* XXX: This just returns any HMAC given by the client without
              * inspecting it. Clearing it or rejecting the request if the
              * signature is invalid might leak information. OTOH, write
@@ -97,6 +189,7 @@ class PairingServerImpl final : public PairingServer::Service {
         Status GetPlayers(ServerContext *ctx, const Identification *req, ServerWriter<Player> *writer) override {
             HANDLER_PROLOGUE
             IDENTIFIED(*req, "tournament");
+            ADMITTED(LIST, false);
             bool correct_signature = authenticated(*req).error_code() == StatusCode::OK;
             for(Player &p: db().tournamentPlayers(req)) {
                 /* TODO: If the request is correctly signed, also sign the
@@ -115,6 +208,7 @@ class PairingServerImpl final : public PairingServer::Service {
         Status GetTournamentGames(ServerContext *ctx, const Identification *req, ServerWriter<Game> *writer) override {
             HANDLER_PROLOGUE
             IDENTIFIED(*req, "tournament");
+            ADMITTED(LIST, false);
             for(Game &g: db().tournamentGames(req)) {
                 /* TODO: If the request is correctly signed, also sign the
                  * game objects returned, since someone with write access to
@@ -130,67 +224,67 @@ class PairingServerImpl final : public PairingServer::Service {
         Status CreateTournament(ServerContext *ctx, const Tournament *req, Identification *resp) override {
             HANDLER_PROLOGUE
             COMPLETE(*req, "tournament");
-            *resp = db().insertTournament(req);
+            ADMITTED(WRITE, false);
+            Tournament t = *req;
+            t.clear_id();
+            *resp = db().insertTournament(&t);
             sign(*resp);
             return Status::OK;
             HANDLER_EPILOGUE
         }
 
         Status PairNextRound(ServerContext *ctx, const Identification *req, ServerWriter<Game> *writer) override {
-            /* This is where the magic needs to happen, and we call into
-             * bbpPairings. For now, to get something running to test
-             * end-to-end, we just do a dummy pairing [utting the players
-             * together in the order the DB returns them. */
             HANDLER_PROLOGUE
             IDENTIFIED(*req, "tournament");
             AUTHENTICATED(*req);
-            Game g;
-            Tournament t;
-            *(t.mutable_id()) = *req;
-            db().getTournament(&t);
-            uint32_t nextRound = db().nextRound(req);
-            if(t.rounds() < nextRound) {
-                return Status(StatusCode::INVALID_ARGUMENT, "Last round paired");
-            }
-
-            tournament::Tournament bbpTournament;
-            bbpTournament.initialColor = tournament::COLOR_WHITE;
-            bbpTournament.expectedRounds = t.rounds();
-            bbpTournament.defaultAcceleration = false;
-
-            // TODO: Build tournament structure.
-            const swisssystems::Info &info = swisssystems::getInfo(swisssystems::DUTCH);
-            std::list<swisssystems::Pairing> pairs = info.computeMatching(std::move(bbpTournament), nullptr);
-
-            g.mutable_tournament()->mutable_id()->set_uuid(req->uuid());
-            g.set_round(nextRound);
-            bool white = true;
-            try {
-                db().transaction([&] {
-                    for(Player &p: db().tournamentPlayers(req)) {
-                        if(white) {
-                            *(g.mutable_white()) = p;
-                        }
-                        else {
-                            *(g.mutable_black()) = p;
+            ADMITTED(WRITE, true);
+            /* Reading the round to pair and inserting its games happen as one
+             * change on the executor, so concurrent calls can't pair the same
+             * round twice. */
+            std::vector<Game> pairings;
+            Status status = serialized(req->uuid(), [&] {
+                Tournament t;
+                *(t.mutable_id()) = *req;
+                db().getTournament(&t);
+                uint32_t nextRound = db().nextRound(req);
+                if(t.rounds() < nextRound) {
+                    return Status(StatusCode::INVALID_ARGUMENT, "Last round paired");
+                }
+
+                std::vector<Player> players = db().tournamentPlayers(req);
+                std::vector<Game> games = db().tournamentGames(req);
+                auto start = std::chrono::steady_clock::now();
+                try {
+                    // The players are only needed afterwards for a capture.
+                    std::vector<Player> input = captureDir? players: std::move(players);
+                    pairings = pairRound(t, nextRound, std::move(input), games);
+                }
+                catch(PairingError &e) {
+                    capture(t, nextRound, players, games, nullptr, e.what(), start);
+                    return Status(StatusCode::FAILED_PRECONDITION, e.what());
+                }
+                capture(t, nextRound, players, games, &pairings, nullptr, start);
+
+                try {
+                    db().transaction([&] {
+                        for(Game &g: pairings) {
                             Identification id = db().insertGame(&g);
                             sign(id);
                             *(g.mutable_id()) = id;
-                            writer->Write(g);
-                            g.clear_white();
-                            g.clear_black();
-                        }
-                        white = !white;
-                    }
-                    if(g.has_white()) {
-                        Identification id = db().insertGame(&g);
-                        sign(id);
-                        *(g.mutable_id()) = id;
-                        writer->Write(g);
-                    }});
-            }
-            catch(DatabaseError &e) {
-                return Status(StatusCode::INTERNAL, "Database error", e.what());
+                        }});
+                }
+                catch(ArchivedError &e) {
+                    return Status(StatusCode::FAILED_PRECONDITION, e.what());
+                }
+                catch(DatabaseError &e) {
+                    return Status(StatusCode::INTERNAL, "Database error", e.what());
+                }
+                versions.bump(req->uuid());
+                return Status::OK; });
+            if(!status.ok())
+                return status;
+            for(Game &g: pairings) {
+                writer->Write(g);
             }
             return Status::OK;
             HANDLER_EPILOGUE
@@ -200,6 +294,7 @@ class PairingServerImpl final : public PairingServer::Service {
         Status GetPlayer(ServerContext *ctx, const Identification *req, Player *resp) override {
             HANDLER_PROLOGUE
             IDENTIFIED(*req, "player");
+            ADMITTED(READ, false);
             *(resp->mutable_id()) = *req;
             return db().getPlayer(resp)?
                 Status::OK:
@@ -210,6 +305,7 @@ class PairingServerImpl final : public PairingServer::Service {
         Status PlayerGames(ServerContext *ctx, const Identification *req, ServerWriter<Game> *writer) override {
             HANDLER_PROLOGUE
             IDENTIFIED(*req, "player");
+            ADMITTED(LIST, false);
             for(Game &g: db().playerGames(req)) {
                 writer->Write(g);
             }
@@ -220,6 +316,7 @@ class PairingServerImpl final : public PairingServer::Service {
         Status SignupPlayer(ServerContext *ctx, const Player *req, Identification *resp) override {
             HANDLER_PROLOGUE
             COMPLETE(*req, "player");
+            ADMITTED(WRITE, signedBy(req->tournament().id()));
             /* TODO: Some additional care needs to be taken in the case of
              * late (that is, after the first round has been paired)
              * registrations. In particular, we may want to register unplayed
@@ -227,9 +324,15 @@ class PairingServerImpl final : public PairingServer::Service {
              * we may also want to require admin privileges to the tournament
              * for late registrations.
              */
-            *resp = db().insertPlayer(req);
-            sign(*resp);
-            return Status::OK;
+            Player p = *req;
+            p.clear_id();
+            p.clear_withdrawn();
+            p.clear_expelled();
+            return serialized(p.tournament().id().uuid(), [&] {
+                    *resp = db().insertPlayer(&p);
+                    versions.bump(p.tournament().id().uuid());
+                    sign(*resp);
+                    return Status::OK; });
             HANDLER_EPILOGUE
         }
 
@@ -266,6 +369,7 @@ class PairingServerImpl final : public PairingServer::Service {
             // TODO
             HANDLER_PROLOGUE
             IDENTIFIED(*req, "game");
+            ADMITTED(READ, false);
             *(resp->mutable_id()) = *req;
             return db().getGame(resp)?
                 Status::OK:
@@ -278,13 +382,22 @@ class PairingServerImpl final : public PairingServer::Service {
             IDENTIFIED(req->gameid(), "game");
             AUTHENTICATED(req->gameid());
             COMPLETE(*req, "game");
+            ADMITTED(WRITE, true);
             /* TODO: We need to only allow this operation on games where no
              * result has been registered already. Changing a result already
              * registered is semantically different and should go through a
              * different operation (with different access restrictions).
              */
-            db().registerResult(req->gameid(), req->result());
-            return Status::OK;
+            Game g;
+            *(g.mutable_id()) = req->gameid();
+            if(!db().getGame(&g))
+                return Status(StatusCode::NOT_FOUND, "No such game");
+            return serialized(g.tournament().id().uuid(), [&] {
+                    db().registerResult(req->gameid(), req->result());
+                    versions.bump(g.tournament().id().uuid());
+                    if(archiveStore)
+                        archive(g.tournament().id());
+                    return Status::OK; });
             HANDLER_EPILOGUE
         }
 
@@ -297,6 +410,42 @@ class PairingServerImpl final : public PairingServer::Service {
 
     private:
         std::string secret;
+        TournamentVersions &versions;
+        TournamentExecutor *executor;
+        AdmissionControl *admission;
+
+        /* Reports the time spent waiting for admission to the client in the
+         * queue-wait-us header, whether or not the call was let in. */
+        bool admitted(ServerContext *ctx, AdmissionControl::Class cls, bool priority,
+                AdmissionControl::Ticket &ticket) {
+            if(!admission)
+                return true;
+            bool ok = admission->admit(cls, priority, ticket);
+            ctx->AddInitialMetadata("queue-wait-us", std::to_string(ticket.waited.count()));
+            return ok;
+        }
+
+        /* Archives the tournament if this was its last missing result. The
+         * result stands even if that fails. */
+        void archive(const Identification &tournament) {
+            try {
+                archiveStore->archive(engine(), tournament, archiveDelete);
+            }
+            catch(const std::exception &e) {
+                std::cerr << "Archiving tournament failed: " << e.what() << std::endl;
+            }
+        }
+
+        bool signedBy(const Identification &id) {
+            return authenticated(id).ok();
+        }
+
+        /* Runs a change to a tournament on the executor, so that changes to
+         * the same tournament don't interleave. */
+        template <typename Func>
+        Status serialized(const std::string &tournament, Func func) {
+            return executor? executor->run(tournament, func): func();
+        }
 
         std::string hmac(const Identification &id) {
             char buf[EVP_MAX_MD_SIZE];
@@ -353,38 +502,61 @@ class PairingServerImpl final : public PairingServer::Service {
         }
 };
 
-class ArgError : public std::exception {
-    public:
-        ArgError(const char *m) : msg(m) {}
-        ArgError(std::string m) : msg(m) {}
-        const char *what() const noexcept { return msg.c_str(); }
-    private:
-        std::string msg;
-};
-
-const char *getArg(const char **argv, int i, int argc, const char *arg) {
-    if(i >= argc) {
-        throw ArgError(std::string("Missing argument to option --") + arg + ".\n");
-    }
-    return argv[i];
-}
-
 int main(int argc, const char **argv) {
     try {
         const char *listen = "127.0.0.1";
         const char *port = "1234";
+        const char *httpPort = NULL;
+        int httpThreads = 4;
+        // Changes mostly wait for the database, so there are a few per core.
+        int writeThreads = 2 * std::thread::hardware_concurrency();
+        int admissionLimit = 0;
+        const char *archiveDir = NULL;
         for(int i = 1; i < argc; i++) {
             std::string arg(argv[i]);
             if(arg == "--help" || arg == "-h") {}
             else if(arg == "--db"     || arg == "-d") { dbname = getArg(argv, ++i, argc, "db"); }
             else if(arg == "--dbuser" || arg == "-u") { dbuser = getArg(argv, ++i, argc, "dbuser"); }
             else if(arg == "--dbpass" || arg == "-P") { dbpass = getArg(argv, ++i, argc, "dbpass"); }
+            else if(arg == "--memory" || arg == "-m") {
+                memoryDir = getArg(argv, ++i, argc, "memory");
+            }
+            else if(arg == "--shards" || arg == "-S") {
+                shardFile = getArg(argv, ++i, argc, "shards");
+            }
             else if(arg == "--listen" || arg == "-l") {
                 listen = getArg(argv, ++i, argc, "listen");
             }
             else if(arg == "--port"   || arg == "-p") {
                 port = getArg(argv, ++i, argc, "port");
             }
+            else if(arg == "--http"   || arg == "-H") {
+                httpPort = getArg(argv, ++i, argc, "http");
+            }
+            else if(arg == "--http-threads") {
+                httpThreads = std::stoi(getArg(argv, ++i, argc, "http-threads"));
+            }
+            else if(arg == "--admission-limit") {
+                admissionLimit = std::stoi(getArg(argv, ++i, argc, "admission-limit"));
+            }
+            else if(arg == "--archive") {
+                archiveDir = getArg(argv, ++i, argc, "archive");
+            }
+            else if(arg == "--archive-delete") {
+                archiveDelete = true;
+            }
+            else if(arg == "--notify") {
+                Database::notifyChanges = true;
+            }
+            else if(arg == "--write-threads") {
+                writeThreads = std::stoi(getArg(argv, ++i, argc, "write-threads"));
+            }
+            else if(arg == "--capture") {
+                captureDir = getArg(argv, ++i, argc, "capture");
+            }
+            else if(arg == "--capture-slower-than") {
+                captureSlowerMs = std::stod(getArg(argv, ++i, argc, "capture-slower-than"));
+            }
             else if(arg == "--secret" || arg == "-s") {
                 const char *secretFile = getArg(argv, ++i, argc, "secret");
             }
@@ -393,9 +565,87 @@ int main(int argc, const char **argv) {
             }
         }
 
+        std::unique_ptr<MemoryStorage> storage;
+        if(memoryDir) {
+            storage.reset(new MemoryStorage(memoryDir));
+            storage->open();
+            memoryStorage = storage.get();
+        }
+        /* Once a tournament's rows are deleted, other servers can only find it
+         * in the archive directory, so all servers sharing the database need
+         * to share that directory too. They pick up new archives when they
+         * hear of the deletion with --notify, and otherwise on a rescan. */
+        if(archiveDelete && (!archiveDir || memoryDir))
+            throw ArgError("--archive-delete needs --archive and Postgres storage.\n");
+        std::unique_ptr<ArchiveStore> archives;
+        if(archiveDir) {
+            archives.reset(new ArchiveStore(archiveDir));
+            archives->load();
+            archiveStore = archives.get();
+        }
+        std::unique_ptr<ShardMap> shards;
+        if(shardFile) {
+            shards.reset(new ShardMap());
+            shards->load(shardFile);
+            shardMap = shards.get();
+
+            /* SIGHUP rereads the shard file and moves tournaments whose
+             * buckets changed shard. It's blocked before any other threads
+             * start, so only this one receives it. */
+            sigset_t hup;
+            sigemptyset(&hup);
+            sigaddset(&hup, SIGHUP);
+            pthread_sigmask(SIG_BLOCK, &hup, NULL);
+            std::thread([hup] {
+                int sig;
+                while(sigwait(&hup, &sig) == 0) {
+                    try {
+                        shardMap->reload(shardFile);
+                        std::cout << "Reloaded shard file" << std::endl;
+                    }
+                    catch(const std::exception &e) {
+                        std::cerr << "Reloading shard file failed: " << e.what() << std::endl;
+                    }
+                }}).detach();
+        }
+
+        // --write-threads 0 leaves ordering changes to the database.
+        std::unique_ptr<TournamentExecutor> executor;
+        if(writeThreads > 0)
+            executor.reset(new TournamentExecutor(writeThreads));
+
+        /* With --admission-limit, at most that many calls run at once, and
+         * reads are shed under load. */
+        std::unique_ptr<AdmissionControl> admission;
+        if(admissionLimit > 0)
+            admission.reset(new AdmissionControl(admissionLimit));
+
         std::string address = listen + std::string(":") + port;
         const char *secret = "deadbeef"; // TODO: Read from secret file.
-        PairingServerImpl service(secret);
+        TournamentVersions versions;
+        PairingServerImpl service(secret, versions, executor.get(), admission.get());
+        HttpGateway gateway(&db, versions, admission.get());
+
+        /* With --notify, writes are announced to other servers on the same
+         * database(s) and theirs are listened for. */
+        std::vector<std::unique_ptr<ChangeListener>> listeners;
+        if(Database::notifyChanges && shardMap) {
+            for(size_t i = 0; i < shardMap->shardCount(); i++) {
+                listeners.emplace_back(new ChangeListener([i] { return shardMap->connect(i); },
+                            versions, archiveStore));
+            }
+        }
+        else if(Database::notifyChanges && !memoryStorage) {
+            listeners.emplace_back(new ChangeListener([] {
+                    std::unique_ptr<Database> d(new Database(dbname, dbuser, dbpass));
+                    d->connect();
+                    return d; }, versions, archiveStore));
+        }
+        for(std::unique_ptr<ChangeListener> &l: listeners) {
+            l->start();
+        }
+        if(httpPort)
+            gateway.start(listen, httpPort, httpThreads);
         ServerBuilder builder;
         // TODO: Optionally SSL server credentials.
         builder.AddListeningPort(address, InsecureServerCredentials());
@@ -0,0 +1,273 @@
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "args.h"
+#include "pairing.h"
+
+/* Plays complete tournaments through pairRound(), the same code path used by
+ * PairNextRound, and reports pairing time, memory and pairing quality for
+ * every round. Ratings are drawn from a normal distribution and results from
+ * the Elo model, both from a seeded generator so runs are repeatable. */
+
+using namespace pairing_server;
+
+struct Options {
+    std::vector<unsigned> players{20, 100, 1000};
+    std::vector<unsigned> rounds{5, 9};
+    uint64_t seed = 1;
+    double absences = 0;
+    double withdrawals = 0;
+    double forfeits = 0;
+    bool json = false;
+};
+
+struct Row {
+    unsigned players, rounds, round;
+    unsigned active;
+    double pairMs;
+    long peakKb;
+    unsigned pairs, byes, floaters, repeats, colorViolations;
+    unsigned scoreDiff; // In half points.
+};
+
+struct History {
+    unsigned score = 0; // In half points.
+    std::string colors;
+    std::set<std::string> opponents;
+    bool withdrawn = false;
+};
+
+std::vector<unsigned> getList(const char *arg) {
+    std::vector<unsigned> list;
+    std::stringstream ss(arg);
+    std::string item;
+    while(std::getline(ss, item, ',')) {
+        list.push_back(std::stoul(item));
+    }
+    return list;
+}
+
+/* Peak RSS since the last call, in kB. Writing 5 to clear_refs resets the
+ * high-water mark the kernel reports as VmHWM. */
+long peakMemory() {
+    long kb = -1;
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while(std::getline(status, line)) {
+        if(line.compare(0, 6, "VmHWM:") == 0)
+            kb = std::stol(line.substr(6));
+    }
+    std::ofstream("/proc/self/clear_refs") << "5";
+    return kb;
+}
+
+std::string randomUuid(std::mt19937_64 &rng) {
+    uint64_t halves[] = {rng(), rng()};
+    return std::string((const char *) &halves[0], 16);
+}
+
+bool colorViolation(const std::string &colors) {
+    int balance = 0;
+    for(char c: colors) {
+        if(c == 'w') balance++;
+        if(c == 'b') balance--;
+    }
+    size_t n = colors.size();
+    bool three = n >= 3 && colors[n - 1] != '-'
+        && colors[n - 1] == colors[n - 2] && colors[n - 2] == colors[n - 3];
+    return three || balance > 2 || balance < -2;
+}
+
+Result playGame(std::mt19937_64 &rng, const Options &opts, uint32_t white, uint32_t black) {
+    std::uniform_real_distribution<double> uniform;
+    if(uniform(rng) < opts.forfeits)
+        return uniform(rng) < 0.5? WHITE_FORFEIT_WIN: BLACK_FORFEIT_WIN;
+
+    // Expected score for white, with a small first-move advantage.
+    double expected = 1 / (1 + std::pow(10, ((double) black - white - 35) / 400));
+    double draw = 0.35 * (1 - 2 * std::fabs(expected - 0.5));
+    double x = uniform(rng);
+    if(x < expected - draw / 2)
+        return WHITE_WIN;
+    if(x < expected + draw / 2)
+        return DRAW;
+    return BLACK_WIN;
+}
+
+void simulate(const Options &opts, unsigned playerCount, unsigned roundCount, std::vector<Row> &rows) {
+    std::mt19937_64 rng(opts.seed ^ ((uint64_t) playerCount << 32) ^ roundCount);
+    std::normal_distribution<double> ratings(1800, 300);
+    std::uniform_real_distribution<double> uniform;
+
+    Tournament t;
+    t.mutable_id()->set_uuid(randomUuid(rng));
+    t.set_name("Simulated tournament");
+    t.set_rounds(roundCount);
+
+    std::vector<Player> players(playerCount);
+    std::unordered_map<std::string, History> history;
+    for(unsigned i = 0; i < playerCount; i++) {
+        Player &p = players[i];
+        p.mutable_id()->set_uuid(randomUuid(rng));
+        p.set_name("Player " + std::to_string(i + 1));
+        p.set_rating(std::max(1000.0, std::min(2800.0, std::round(ratings(rng)))));
+        *(p.mutable_tournament()) = t;
+        history[p.id().uuid()];
+    }
+
+    std::vector<Game> games;
+    for(unsigned round = 1; round <= roundCount; round++) {
+        unsigned active = 0;
+        for(Player &p: players) {
+            History &h = history[p.id().uuid()];
+            if(round > 1 && !h.withdrawn && uniform(rng) < opts.withdrawals)
+                h.withdrawn = true;
+            p.set_withdrawn(h.withdrawn || uniform(rng) < opts.absences);
+            if(!p.withdrawn()) active++;
+        }
+
+        Row row = Row();
+        row.players = playerCount;
+        row.rounds = roundCount;
+        row.round = round;
+        row.active = active;
+
+        peakMemory();
+        auto start = std::chrono::steady_clock::now();
+        std::vector<Game> pairings = pairRound(t, round, players, games);
+        row.pairMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        row.peakKb = peakMemory();
+
+        std::set<std::string> paired;
+        for(Game &g: pairings) {
+            g.mutable_id()->set_uuid(randomUuid(rng));
+            History &white = history[g.white().id().uuid()];
+            paired.insert(g.white().id().uuid());
+            if(!g.has_black()) {
+                row.byes++;
+                white.score += 2;
+                white.colors += '-';
+                games.push_back(g);
+                continue;
+            }
+
+            History &black = history[g.black().id().uuid()];
+            paired.insert(g.black().id().uuid());
+            row.pairs++;
+            if(white.score != black.score) {
+                row.floaters++;
+                row.scoreDiff += white.score > black.score?
+                    white.score - black.score:
+                    black.score - white.score;
+            }
+            if(white.opponents.count(g.black().id().uuid()))
+                row.repeats++;
+            white.opponents.insert(g.black().id().uuid());
+            black.opponents.insert(g.white().id().uuid());
+            white.colors += 'w';
+            black.colors += 'b';
+            if(colorViolation(white.colors)) row.colorViolations++;
+            if(colorViolation(black.colors)) row.colorViolations++;
+
+            Result result = playGame(rng, opts, g.white().rating(), g.black().rating());
+            g.set_result(result);
+            switch(result) {
+                case WHITE_WIN: case WHITE_FORFEIT_WIN: white.score += 2; break;
+                case BLACK_WIN: case BLACK_FORFEIT_WIN: black.score += 2; break;
+                default: white.score++; black.score++; break;
+            }
+            games.push_back(g);
+        }
+        for(Player &p: players) {
+            if(!paired.count(p.id().uuid()))
+                history[p.id().uuid()].colors += '-';
+        }
+
+        rows.push_back(row);
+        std::cerr << playerCount << " players, round " << round << "/" << roundCount
+            << ": " << row.pairMs << " ms" << std::endl;
+    }
+}
+
+void writeCsv(std::ostream &out, const std::vector<Row> &rows) {
+    out << "players,rounds,round,active,pair_ms,peak_rss_kb,pairs,byes,floaters,score_diff,repeats,color_violations\n";
+    for(const Row &r: rows) {
+        out << r.players << ',' << r.rounds << ',' << r.round << ',' << r.active << ','
+            << r.pairMs << ',' << r.peakKb << ',' << r.pairs << ',' << r.byes << ','
+            << r.floaters << ',' << r.scoreDiff / 2.0 << ',' << r.repeats << ','
+            << r.colorViolations << '\n';
+    }
+}
+
+void writeJson(std::ostream &out, const std::vector<Row> &rows) {
+    out << "[\n";
+    for(size_t i = 0; i < rows.size(); i++) {
+        const Row &r = rows[i];
+        out << "  {\"players\": " << r.players << ", \"rounds\": " << r.rounds
+            << ", \"round\": " << r.round << ", \"active\": " << r.active
+            << ", \"pair_ms\": " << r.pairMs << ", \"peak_rss_kb\": " << r.peakKb
+            << ", \"pairs\": " << r.pairs << ", \"byes\": " << r.byes
+            << ", \"floaters\": " << r.floaters << ", \"score_diff\": " << r.scoreDiff / 2.0
+            << ", \"repeats\": " << r.repeats << ", \"color_violations\": " << r.colorViolations
+            << "}" << (i + 1 < rows.size()? ",": "") << "\n";
+    }
+    out << "]\n";
+}
+
+int main(int argc, const char **argv) {
+    try {
+        Options opts;
+        const char *output = NULL;
+        for(int i = 1; i < argc; i++) {
+            std::string arg(argv[i]);
+            if(arg == "--help" || arg == "-h") {
+                std::cout << "Usage: pairing-simulator [--players N,...] [--rounds N,...] [--seed N]\n"
+                    "       [--absences P] [--withdrawals P] [--forfeits P] [--json] [--output FILE]\n";
+                return 0;
+            }
+            else if(arg == "--players"     || arg == "-n") { opts.players = getList(getArg(argv, ++i, argc, "players")); }
+            else if(arg == "--rounds"      || arg == "-r") { opts.rounds = getList(getArg(argv, ++i, argc, "rounds")); }
+            else if(arg == "--seed"        || arg == "-s") { opts.seed = std::stoull(getArg(argv, ++i, argc, "seed")); }
+            else if(arg == "--absences"    || arg == "-a") { opts.absences = std::stod(getArg(argv, ++i, argc, "absences")); }
+            else if(arg == "--withdrawals" || arg == "-w") { opts.withdrawals = std::stod(getArg(argv, ++i, argc, "withdrawals")); }
+            else if(arg == "--forfeits"    || arg == "-f") { opts.forfeits = std::stod(getArg(argv, ++i, argc, "forfeits")); }
+            else if(arg == "--json"        || arg == "-j") { opts.json = true; }
+            else if(arg == "--output"      || arg == "-o") { output = getArg(argv, ++i, argc, "output"); }
+            else {
+                throw ArgError(std::string("Unknown option ") + arg + ".\n");
+            }
+        }
+
+        std::vector<Row> rows;
+        for(unsigned players: opts.players) {
+            for(unsigned rounds: opts.rounds) {
+                simulate(opts, players, rounds, rows);
+            }
+        }
+
+        std::ofstream file;
+        if(output) {
+            file.open(output);
+            if(!file)
+                throw ArgError(std::string("Can't open ") + output + ".\n");
+        }
+        std::ostream &out = output? file: std::cout;
+        if(opts.json)
+            writeJson(out, rows);
+        else
+            writeCsv(out, rows);
+    }
+    catch(const std::exception &e) {
+        std::cerr << e.what();
+        return 1;
+    }
+    return 0;
+}
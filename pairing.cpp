@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <new>
+#include <unordered_map>
+
+#include "pairing.h"
+
+using namespace pairing_server;
+
+static tournament::points matchPoints(const tournament::Tournament &t, const tournament::Player &p,
+        const tournament::Match &m) {
+    if(m.matchScore == tournament::MATCH_SCORE_DRAW)
+        return t.pointsForDraw;
+    if(m.matchScore == tournament::MATCH_SCORE_WIN)
+        return m.opponent == p.id && m.participatedInPairing?
+            t.pointsForPairingAllocatedBye:
+            t.pointsForWin;
+    if(!m.participatedInPairing)
+        return t.pointsForZeroPointBye;
+    return m.gameWasPlayed? t.pointsForLoss: t.pointsForForfeitLoss;
+}
+
+tournament::Tournament bbpTournament(const Tournament &t, uint32_t round,
+        std::vector<Player> &players, const std::vector<Game> &games) {
+    tournament::Tournament bbp;
+    bbp.initialColor = tournament::COLOR_WHITE;
+    bbp.expectedRounds = t.rounds();
+    bbp.playedRounds = round - 1;
+    bbp.defaultAcceleration = false;
+
+    /* Pairing numbers go by descending rating. Ties go by name and then by
+     * UUID, so that the storage engine's row order doesn't matter. */
+    std::sort(players.begin(), players.end(), [](const Player &a, const Player &b) {
+            if(a.rating() != b.rating())
+                return a.rating() > b.rating();
+            if(a.name() != b.name())
+                return a.name() < b.name();
+            return a.id().uuid() < b.id().uuid(); });
+
+    std::unordered_map<std::string, tournament::player_index> index;
+    for(size_t i = 0; i < players.size(); i++) {
+        index[players[i].id().uuid()] = i;
+        bbp.players.push_back(tournament::Player(i, 0, players[i].rating()));
+        bbp.playersByRank.push_back(i);
+    }
+
+    /* bbpPairings takes matches[k] to be round k + 1, and the storage
+     * engines don't return games in any particular order, so each game goes
+     * into the slot of its round. Players who weren't paired in a round (late
+     * entries, or rounds where they had withdrawn) keep the zero-point bye
+     * the slot starts out with. */
+    std::vector<std::vector<bool>> paired(players.size(), std::vector<bool>(round - 1));
+    for(tournament::Player &p: bbp.players) {
+        p.matches.assign(round - 1, tournament::Match(p.id, tournament::COLOR_NONE,
+                    tournament::MATCH_SCORE_LOSS, false, false));
+    }
+    auto place = [&](tournament::player_index p, uint32_t r, const tournament::Match &m) {
+        if(paired[p][r - 1])
+            throw PairingError("Player has more than one game in round " + std::to_string(r));
+        paired[p][r - 1] = true;
+        bbp.players[p].matches[r - 1] = m;
+    };
+
+    for(const Game &g: games) {
+        if(g.round() >= round)
+            continue;
+        if(g.round() < 1)
+            throw PairingError("Game has no round");
+        auto white = index.find(g.white().id().uuid());
+        if(white == index.end())
+            throw PairingError("Game refers to a player not in the tournament");
+        tournament::player_index w = white->second;
+
+        if(!g.has_black()) {
+            place(w, g.round(), tournament::Match(w, tournament::COLOR_NONE,
+                        tournament::MATCH_SCORE_WIN, false, true));
+            continue;
+        }
+
+        auto black = index.find(g.black().id().uuid());
+        if(black == index.end())
+            throw PairingError("Game refers to a player not in the tournament");
+        tournament::player_index b = black->second;
+
+        tournament::MatchScore whiteScore, blackScore;
+        bool played = true;
+        switch(g.result()) {
+            case DRAW:
+                whiteScore = blackScore = tournament::MATCH_SCORE_DRAW;
+                break;
+            case WHITE_FORFEIT_WIN:
+                played = false;
+                // Fall through.
+            case WHITE_WIN:
+                whiteScore = tournament::MATCH_SCORE_WIN;
+                blackScore = tournament::MATCH_SCORE_LOSS;
+                break;
+            case BLACK_FORFEIT_WIN:
+                played = false;
+                // Fall through.
+            case BLACK_WIN:
+                whiteScore = tournament::MATCH_SCORE_LOSS;
+                blackScore = tournament::MATCH_SCORE_WIN;
+                break;
+            default:
+                throw PairingError("Round " + std::to_string(g.round()) + " has games without a result");
+        }
+        place(w, g.round(), tournament::Match(b, tournament::COLOR_WHITE,
+                    whiteScore, played, true));
+        place(b, g.round(), tournament::Match(w, tournament::COLOR_BLACK,
+                    blackScore, played, true));
+    }
+
+    /* Players who are withdrawn or expelled now also get a zero-point bye
+     * for the round being paired, which keeps bbpPairings from pairing
+     * them. */
+    for(size_t i = 0; i < players.size(); i++) {
+        tournament::Player &p = bbp.players[i];
+        for(const tournament::Match &m: p.matches)
+            p.scoreWithoutAcceleration += matchPoints(bbp, p, m);
+        if(players[i].withdrawn() || players[i].expelled()) {
+            p.matches.push_back(tournament::Match(p.id, tournament::COLOR_NONE,
+                        tournament::MATCH_SCORE_LOSS, false, false));
+        }
+    }
+
+    bbp.updateRanks();
+    bbp.computePlayerData();
+    return bbp;
+}
+
+std::list<swisssystems::Pairing> dutchMatching(tournament::Tournament &&bbp) {
+    const swisssystems::Info &info = swisssystems::getInfo(swisssystems::DUTCH);
+    try {
+        return info.computeMatching(std::move(bbp), nullptr);
+    }
+    catch(const std::bad_alloc &) {
+        throw;
+    }
+    catch(const std::exception &e) {
+        throw PairingError(std::string("No pairing: ") + e.what());
+    }
+}
+
+std::vector<Game> pairRound(const Tournament &t, uint32_t round,
+        std::vector<Player> players, const std::vector<Game> &games) {
+    std::list<swisssystems::Pairing> pairs = dutchMatching(bbpTournament(t, round, players, games));
+    return pairingsToGames(t, round, players, pairs);
+}
+
+std::vector<Game> pairingsToGames(const Tournament &t, uint32_t round,
+        const std::vector<Player> &players, const std::list<swisssystems::Pairing> &pairs) {
+    std::vector<Game> pairings;
+    pairings.reserve(pairs.size());
+    for(const swisssystems::Pairing &pair: pairs) {
+        Game g;
+        g.mutable_tournament()->mutable_id()->set_uuid(t.id().uuid());
+        g.set_round(round);
+        *(g.mutable_white()) = players[pair.white];
+        if(pair.black != pair.white)
+            *(g.mutable_black()) = players[pair.black];
+        pairings.push_back(g);
+    }
+    return pairings;
+}
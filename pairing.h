@@ -0,0 +1,48 @@
+#ifndef _PAIRING_H
+#define _PAIRING_H
+
+#include <exception>
+#include <list>
+#include <string>
+#include <vector>
+
+#include <swisssystems/common.h>
+#include <tournament/tournament.h>
+
+#include "types.pb.h"
+
+/* Translates a tournament as stored by a Storage engine into the structures
+ * bbpPairings works on. players is sorted into pairing number order, so that
+ * the player ids in the returned tournament index into it. */
+tournament::Tournament bbpTournament(const pairing_server::Tournament &t, uint32_t round,
+        std::vector<pairing_server::Player> &players,
+        const std::vector<pairing_server::Game> &games);
+
+/* Runs the Dutch matching on a tournament from bbpTournament(). bbpPairings'
+ * own exceptions, such as the one for a round without a valid pairing, are
+ * thrown as PairingError. */
+std::list<swisssystems::Pairing> dutchMatching(tournament::Tournament &&bbp);
+
+/* Turns the pairs from dutchMatching() into games of the round, indexing
+ * players as sorted by bbpTournament(). */
+std::vector<pairing_server::Game> pairingsToGames(const pairing_server::Tournament &t, uint32_t round,
+        const std::vector<pairing_server::Player> &players,
+        const std::list<swisssystems::Pairing> &pairs);
+
+/* Pairs the given round with the Dutch system. The games returned have
+ * everything but an id filled in; a bye is a game without black. */
+std::vector<pairing_server::Game> pairRound(const pairing_server::Tournament &t, uint32_t round,
+        std::vector<pairing_server::Player> players,
+        const std::vector<pairing_server::Game> &games);
+
+class PairingError : public std::exception {
+    public:
+        PairingError(const char *m) : msg(m) {}
+        PairingError(std::string m) : msg(m) {}
+        const char *what() const noexcept { return msg.c_str(); }
+
+    private:
+        std::string msg;
+};
+
+#endif
@@ -1,3 +1,4 @@
+DROP TABLE IF EXISTS shard_bucket;
 DROP TABLE IF EXISTS game;
 DROP TABLE IF EXISTS player;
 DROP TABLE IF EXISTS tournament;
@@ -27,7 +28,21 @@ CREATE TABLE game (
     white INTEGER NOT NULL REFERENCES player(id),
     /* If a player gets a bye, we create a game for them where black is NULL. */
     black INTEGER REFERENCES player(id),
-    result INTEGER CHECK (result IS NULL OR result IN (1, -1, 0)));
+    /* A Result value, NULL until the game is played. Databases created with
+     * the older CHECK (result IN (1, -1, 0)) reject decisive results; run
+     *   ALTER TABLE game DROP CONSTRAINT game_result_check,
+     *       ADD CONSTRAINT game_result_check
+     *       CHECK (result IS NULL OR result BETWEEN 1 AND 5);
+     * to migrate them. */
+    result INTEGER CHECK (result IS NULL OR result BETWEEN 1 AND 5));
 CREATE INDEX game_tournament_idx ON game(tournament);
 CREATE INDEX game_white_idx ON game(white);
 CREATE INDEX game_black_idx ON game(black);
+-- Keeps counting the games still to be played cheap.
+CREATE INDEX game_unfinished_idx ON game(tournament) WHERE black IS NOT NULL AND result IS NULL;
+
+/* With --shards, the first shard records which shard holds each bucket, so
+ * that servers sharing the shards agree on it. */
+CREATE TABLE shard_bucket (
+    bucket INTEGER PRIMARY KEY CHECK (bucket BETWEEN 0 AND 65535),
+    shard INTEGER NOT NULL);
@@ -0,0 +1,401 @@
+#include <fstream>
+#include <sstream>
+
+#include "sharded-storage.h"
+#include "uuid.h"
+
+using namespace pairing_server;
+
+static uint32_t bucketOf(const std::string &uuid) {
+    if(uuid.size() < 2)
+        return 0;
+    return ((unsigned char) uuid[0] << 8) | (unsigned char) uuid[1];
+}
+
+/* Children get version 8 UUIDs in their tournament's bucket, which tells them
+ * apart from the version 4 UUIDs Postgres and clients generate. */
+static bool isChildId(const std::string &uuid) {
+    return uuid.size() == 16 && ((unsigned char) uuid[6] >> 4) == 8;
+}
+
+ShardMap::ShardMap() : buckets(new std::atomic<uint16_t>[BUCKETS]) {
+    for(uint32_t b = 0; b < BUCKETS; b++) {
+        buckets[b] = 0;
+    }
+}
+
+void ShardMap::load(const char *path) {
+    File file = parse(path);
+    {
+        std::lock_guard<std::mutex> guard(configLock);
+        shards.assign(file.shards.begin(), file.shards.end());
+        for(uint32_t b = 0; b < BUCKETS; b++) {
+            buckets[b] = file.buckets[b];
+        }
+    }
+
+    // Waits while another server is moving buckets.
+    home = connect(0);
+    home->lockBucketsShared();
+    std::vector<uint16_t> recorded = home->buckets();
+    if(recorded.empty()) {
+        home->recordBuckets(file.buckets);
+        recorded = home->buckets();
+    }
+    if(recorded != file.buckets)
+        throw DatabaseError(std::string("The buckets in ") + path
+                + " don't match the ones recorded in the first shard");
+}
+
+void ShardMap::reload(const char *path) {
+    std::lock_guard<std::mutex> reloading(reloadLock);
+    File file = parse(path);
+    {
+        std::lock_guard<std::mutex> guard(configLock);
+        if(file.shards.size() < shards.size())
+            throw DatabaseError("Shards can't be removed from the shard file");
+        for(size_t i = 0; i < shards.size(); i++) {
+            const Shard &a = shards[i], &b = file.shards[i];
+            if(a.host != b.host || a.dbname != b.dbname || a.user != b.user || a.password != b.password)
+                throw DatabaseError("Shard " + std::to_string(i) + " changed in the shard file");
+        }
+        for(size_t i = shards.size(); i < file.shards.size(); i++) {
+            shards.push_back(file.shards[i]);
+        }
+    }
+
+    bool changed = false;
+    for(uint32_t b = 0; b < BUCKETS && !changed; b++) {
+        changed = (buckets[b] & ~MOVING) != file.buckets[b];
+    }
+    if(!changed)
+        return;
+    if(!home->tryLockBuckets())
+        throw DatabaseError("Other servers are using the shards; stop them before moving buckets");
+
+    std::vector<std::unique_ptr<Database>> connections(file.shards.size());
+    auto shard = [&](uint16_t i) -> Database & {
+        if(!connections[i])
+            connections[i] = connect(i);
+        return *connections[i];
+    };
+    try {
+        /* One bucket at a time, so that writes are only refused for the
+         * tournaments being copied. */
+        for(uint32_t b = 0; b < BUCKETS; b++) {
+            uint16_t from = buckets[b] & ~MOVING, to = file.buckets[b];
+            if(from != to)
+                move(b, from, to, shard(from), shard(to));
+        }
+    }
+    catch(...) {
+        home->unlockBuckets();
+        throw;
+    }
+    home->unlockBuckets();
+}
+
+size_t ShardMap::shardCount() {
+    std::lock_guard<std::mutex> guard(configLock);
+    return shards.size();
+}
+
+std::unique_ptr<Database> ShardMap::connect(size_t shard) {
+    const Shard *s;
+    {
+        std::lock_guard<std::mutex> guard(configLock);
+        if(shard >= shards.size())
+            throw DatabaseError("No such shard");
+        s = &shards[shard];
+    }
+    std::unique_ptr<Database> db(new Database(s->dbname.c_str(), s->user.c_str(),
+                s->password.c_str(), s->host.c_str()));
+    db->connect();
+    return db;
+}
+
+size_t ShardMap::shardFor(const std::string &uuid, bool write) {
+    uint16_t shard = buckets[bucketOf(uuid)];
+    if(write && (shard & MOVING))
+        throw DatabaseError("Tournament is being moved to another shard, try again");
+    return shard & ~MOVING;
+}
+
+bool ShardMap::ownerOf(const std::string &uuid, std::string *tournament) {
+    std::lock_guard<std::mutex> guard(ownersLock);
+    auto it = owners.find(uuid);
+    if(it == owners.end())
+        return false;
+    *tournament = it->second;
+    return true;
+}
+
+void ShardMap::setOwner(const std::string &uuid, const std::string &tournament) {
+    std::lock_guard<std::mutex> guard(ownersLock);
+    owners[uuid] = tournament;
+}
+
+ShardMap::File ShardMap::parse(const char *path) {
+    std::ifstream in(path);
+    if(!in)
+        throw DatabaseError(std::string("Can't open shard file ") + path);
+
+    File file;
+    file.buckets.assign(BUCKETS, UINT16_MAX);
+    std::string line;
+    while(std::getline(in, line)) {
+        std::stringstream words(line);
+        std::string kind;
+        if(!(words >> kind) || kind[0] == '#')
+            continue;
+        if(kind == "shard") {
+            Shard s;
+            if(!(words >> s.host >> s.dbname >> s.user >> s.password))
+                throw DatabaseError("Malformed shard line: " + line);
+            file.shards.push_back(s);
+        }
+        else if(kind == "buckets") {
+            uint32_t first, last, shard;
+            char dash;
+            if(!(words >> first >> dash >> last >> shard) || dash != '-'
+                    || first > last || last >= BUCKETS || shard >= MOVING)
+                throw DatabaseError("Malformed buckets line: " + line);
+            for(uint32_t b = first; b <= last; b++) {
+                file.buckets[b] = shard;
+            }
+        }
+        else {
+            throw DatabaseError("Unknown line in shard file: " + line);
+        }
+    }
+
+    for(uint32_t b = 0; b < BUCKETS; b++) {
+        if(file.buckets[b] >= file.shards.size())
+            throw DatabaseError("Bucket " + std::to_string(b) + " isn't assigned to a shard");
+    }
+    return file;
+}
+
+/* Copies every tournament in the bucket to the new shard while writes to
+ * them are refused, then points the bucket at the new shard and deletes the
+ * old copies. Reads keep going to the old shard until the switch. */
+void ShardMap::move(uint32_t bucket, uint16_t from, uint16_t to, Database &src, Database &dst) {
+    std::string low(16, '\x00'), high(16, '\xff');
+    low[0] = high[0] = bucket >> 8;
+    low[1] = high[1] = bucket & 0xff;
+
+    {
+        // Waits for writes already in progress to finish.
+        std::unique_lock<std::shared_mutex> guard(writers);
+        buckets[bucket] = from | MOVING;
+    }
+
+    std::vector<Tournament> moved;
+    try {
+        moved = src.tournamentsBetween(low, high);
+        for(Tournament &t: moved) {
+            dst.transaction([&] {
+                // Left behind if an earlier move was interrupted.
+                dst.deleteTournament(t.id());
+                dst.insertTournament(&t);
+                for(Player &p: src.tournamentPlayers(&t.id())) {
+                    *(p.mutable_tournament()->mutable_id()) = t.id();
+                    dst.insertPlayer(&p);
+                }
+                for(Game &g: src.tournamentGames(&t.id())) {
+                    *(g.mutable_tournament()->mutable_id()) = t.id();
+                    dst.insertGame(&g);
+                }});
+        }
+        home->setBuckets(bucket, bucket, to);
+    }
+    catch(...) {
+        buckets[bucket] = from;
+        throw;
+    }
+
+    buckets[bucket] = to;
+    for(Tournament &t: moved) {
+        src.transaction([&] { src.deleteTournament(t.id()); });
+    }
+}
+
+ShardedStorage::ShardedStorage(ShardMap &map) : map(map) {}
+
+void ShardedStorage::begin() {
+    if(inTransaction)
+        throw DatabaseError("Transaction already in progress");
+    transactionGuard = std::shared_lock<std::shared_mutex>(map.writers);
+    inTransaction = true;
+    transactionShard = -1;
+}
+
+void ShardedStorage::commit() {
+    std::shared_lock<std::shared_mutex> guard = std::move(transactionGuard);
+    int s = transactionShard;
+    inTransaction = false;
+    transactionShard = -1;
+    if(s >= 0)
+        shard(s).commit();
+}
+
+void ShardedStorage::rollback() {
+    std::shared_lock<std::shared_mutex> guard = std::move(transactionGuard);
+    int s = transactionShard;
+    inTransaction = false;
+    transactionShard = -1;
+    if(s >= 0)
+        shard(s).rollback();
+}
+
+bool ShardedStorage::getTournament(Tournament *t) {
+    return reader(t->id().uuid()).getTournament(t);
+}
+
+int ShardedStorage::nextRound(const Identification *id) {
+    return reader(id->uuid()).nextRound(id);
+}
+
+int ShardedStorage::unfinishedGames(const Identification *id) {
+    return reader(id->uuid()).unfinishedGames(id);
+}
+
+std::vector<Player> ShardedStorage::tournamentPlayers(const Identification *id) {
+    return reader(id->uuid()).tournamentPlayers(id);
+}
+
+std::vector<Game> ShardedStorage::tournamentGames(const Identification *id) {
+    return reader(id->uuid()).tournamentGames(id);
+}
+
+Identification ShardedStorage::insertTournament(const Tournament *t) {
+    auto guard = writeLock();
+    Tournament copy = *t;
+    if(copy.id().uuid().size() != 16)
+        copy.mutable_id()->set_uuid(randomUuid());
+    return writer(copy.id().uuid()).insertTournament(&copy);
+}
+
+bool ShardedStorage::getPlayer(Player *p) {
+    return reader(tournamentOf(p->id().uuid(), false)).getPlayer(p);
+}
+
+std::vector<Game> ShardedStorage::playerGames(const Identification *id) {
+    return reader(tournamentOf(id->uuid(), false)).playerGames(id);
+}
+
+Identification ShardedStorage::insertPlayer(const Player *p) {
+    auto guard = writeLock();
+    Player copy = *p;
+    if(copy.id().uuid().size() != 16)
+        *(copy.mutable_id()) = childId(p->tournament().id());
+    else if(isChildId(copy.id().uuid()) && bucketOf(copy.id().uuid()) != bucketOf(p->tournament().id().uuid()))
+        throw DatabaseError("Player UUID is in another tournament's bucket");
+    return writer(p->tournament().id().uuid()).insertPlayer(&copy);
+}
+
+bool ShardedStorage::getGame(Game *g) {
+    return reader(tournamentOf(g->id().uuid(), true)).getGame(g);
+}
+
+Identification ShardedStorage::insertGame(const Game *g) {
+    auto guard = writeLock();
+    Game copy = *g;
+    if(copy.id().uuid().size() != 16)
+        *(copy.mutable_id()) = childId(g->tournament().id());
+    else if(isChildId(copy.id().uuid()) && bucketOf(copy.id().uuid()) != bucketOf(g->tournament().id().uuid()))
+        throw DatabaseError("Game UUID is in another tournament's bucket");
+    return writer(g->tournament().id().uuid()).insertGame(&copy);
+}
+
+void ShardedStorage::registerResult(const Identification &gameId, Result result) {
+    auto guard = writeLock();
+    writer(tournamentOf(gameId.uuid(), true)).registerResult(gameId, result);
+}
+
+void ShardedStorage::deleteTournament(const Identification &id) {
+    auto guard = writeLock();
+    writer(id.uuid()).deleteTournament(id);
+}
+
+/* Private helper methods: */
+Database &ShardedStorage::shard(size_t i) {
+    if(connections.size() <= i)
+        connections.resize(i + 1);
+    if(!connections[i])
+        connections[i] = map.connect(i);
+    return *connections[i];
+}
+
+Database &ShardedStorage::reader(const std::string &uuid) {
+    return shard(map.shardFor(uuid, false));
+}
+
+Database &ShardedStorage::writer(const std::string &uuid) {
+    size_t s = map.shardFor(uuid, true);
+    if(inTransaction) {
+        if(transactionShard < 0) {
+            shard(s).begin();
+            transactionShard = s;
+        }
+        else if((size_t) transactionShard != s) {
+            throw DatabaseError("Transaction spans several shards");
+        }
+    }
+    return shard(s);
+}
+
+std::shared_lock<std::shared_mutex> ShardedStorage::writeLock() {
+    if(inTransaction)
+        return std::shared_lock<std::shared_mutex>();
+    return std::shared_lock<std::shared_mutex>(map.writers);
+}
+
+/* A new UUID in the same bucket as the tournament. */
+Identification ShardedStorage::childId(const Identification &tournament) {
+    std::string uuid = randomUuid();
+    uuid[0] = tournament.uuid().size() > 0? tournament.uuid()[0]: 0;
+    uuid[1] = tournament.uuid().size() > 1? tournament.uuid()[1]: 0;
+    uuid[6] = (uuid[6] & 0x0f) | 0x80;
+    Identification id;
+    id.set_uuid(uuid);
+    return id;
+}
+
+/* A UUID in the bucket of the player's or game's tournament, to route it by.
+ * Other players and games are looked for on every shard. The tournament of a
+ * player or game never changes, so what is found can be kept. While a
+ * tournament is being moved it is on two shards, which both give the same
+ * answer. */
+std::string ShardedStorage::tournamentOf(const std::string &uuid, bool game) {
+    std::string tournament;
+    if(isChildId(uuid))
+        return uuid;
+    if(map.ownerOf(uuid, &tournament))
+        return tournament;
+
+    size_t home = map.shardFor(uuid, false);
+    size_t count = map.shardCount();
+    for(size_t i = 0; i < count; i++) {
+        // The shard the UUID's own bucket is on is the likeliest.
+        Database &db = shard(i == 0? home: (i <= home? i - 1: i));
+        bool found;
+        if(game) {
+            Game g;
+            g.mutable_id()->set_uuid(uuid);
+            found = db.getGame(&g);
+            tournament = g.tournament().id().uuid();
+        }
+        else {
+            Player p;
+            p.mutable_id()->set_uuid(uuid);
+            found = db.getPlayer(&p);
+            tournament = p.tournament().id().uuid();
+        }
+        if(found) {
+            map.setOwner(uuid, tournament);
+            return tournament;
+        }
+    }
+    return uuid;
+}
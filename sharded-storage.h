@@ -0,0 +1,147 @@
+#ifndef _SHARDED_STORAGE_H
+#define _SHARDED_STORAGE_H
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "database.h"
+
+/* Assignment of tournaments to Postgres shards.
+ *
+ * The first two bytes of a tournament's UUID are its bucket, and the UUIDs of
+ * its players and games are generated with the same two bytes, so every
+ * object can be routed without a lookup. Those UUIDs are marked with version
+ * 8 instead of 4. Other players and games, created before sharding was turned
+ * on or given a UUID by the client, are looked up on every shard once, and
+ * are routed by their tournament from then on. The shard file maps bucket
+ * ranges to shards:
+ *
+ *     # shard <host> <dbname> <user> <password>, numbered from 0
+ *     shard 127.0.0.1 pairings0 pairings secret
+ *     shard 10.0.0.2 pairings1 pairings secret
+ *     # buckets <first>-<last> <shard>, covering 0-65535
+ *     buckets 0-32767 0
+ *     buckets 32768-65535 1
+ *
+ * The first shard records the shard of every bucket in its shard_bucket
+ * table. The first server to start records its shard file there, and servers
+ * whose shard file disagrees with it refuse to start.
+ *
+ * reload() reads the file again and moves the tournaments in any bucket that
+ * changed shard while the server keeps running, one bucket at a time. Shards
+ * can be added to the end of the file, but existing ones can't be changed.
+ * This isn't a rebalance across running servers: the others would keep
+ * routing by their old map, and nothing tells them about a move. So only one
+ * server may move buckets, and only while no other server is using the
+ * shards: every server holds an advisory lock on the first shard shared, and
+ * moving buckets needs it exclusively.
+ *
+ * To spread an existing database over several, list it as the first shard
+ * with every bucket on it and start the servers. To move buckets, stop all
+ * servers but one, edit its shard file and send it SIGHUP. Once it has
+ * reported the reload, copy the file to the other servers and start them
+ * again. */
+class ShardMap {
+    public:
+        static const uint32_t BUCKETS = 1 << 16;
+
+        ShardMap();
+
+        void load(const char *path);
+        void reload(const char *path);
+
+        size_t shardCount();
+        std::unique_ptr<Database> connect(size_t shard);
+        /* Returns the shard holding the object. When writing, fails while
+         * the object's bucket is being moved. */
+        size_t shardFor(const std::string &uuid, bool write);
+
+        /* The tournaments of players and games that aren't in their
+         * tournament's bucket, once they have been looked up. */
+        bool ownerOf(const std::string &uuid, std::string *tournament);
+        void setOwner(const std::string &uuid, const std::string &tournament);
+
+        /* Writers hold this shared for the length of their operation or
+         * transaction, so that taking it exclusively waits for them. */
+        std::shared_mutex writers;
+
+    private:
+        static const uint16_t MOVING = 0x8000;
+
+        struct Shard {
+            std::string host, dbname, user, password;
+        };
+
+        struct File {
+            std::vector<Shard> shards;
+            std::vector<uint16_t> buckets;
+        };
+
+        std::mutex reloadLock;
+        std::mutex configLock;
+        // A deque, since connections keep pointers to the strings.
+        std::deque<Shard> shards;
+        std::unique_ptr<std::atomic<uint16_t>[]> buckets;
+        // Connection to the first shard, which holds the bucket lock.
+        std::unique_ptr<Database> home;
+
+        std::mutex ownersLock;
+        std::unordered_map<std::string, std::string> owners;
+
+        File parse(const char *path);
+        void move(uint32_t bucket, uint16_t from, uint16_t to, Database &src, Database &dst);
+};
+
+/* Storage engine that routes each operation to the shard holding its
+ * tournament. Like Database, one is used per thread. A transaction may only
+ * touch one shard, which is the case for everything the server does. */
+class ShardedStorage : public Storage {
+    public:
+        explicit ShardedStorage(ShardMap &map);
+
+        void begin() override;
+        void commit() override;
+        void rollback() override;
+
+        // Operations on tournaments:
+        bool getTournament(pairing_server::Tournament *t) override;
+        int nextRound(const pairing_server::Identification *id) override;
+        int unfinishedGames(const pairing_server::Identification *id) override;
+        std::vector<pairing_server::Player> tournamentPlayers(const pairing_server::Identification *id) override;
+        std::vector<pairing_server::Game> tournamentGames(const pairing_server::Identification *id) override;
+        pairing_server::Identification insertTournament(const pairing_server::Tournament *t) override;
+
+        // Operations on players:
+        bool getPlayer(pairing_server::Player *p) override;
+        std::vector<pairing_server::Game> playerGames(const pairing_server::Identification *id) override;
+        pairing_server::Identification insertPlayer(const pairing_server::Player *p) override;
+
+        // Operations on games:
+        bool getGame(pairing_server::Game *g) override;
+        pairing_server::Identification insertGame(const pairing_server::Game *g) override;
+        void registerResult(const pairing_server::Identification &gameId, pairing_server::Result result) override;
+
+        void deleteTournament(const pairing_server::Identification &id) override;
+
+    private:
+        ShardMap &map;
+        std::vector<std::unique_ptr<Database>> connections;
+        bool inTransaction = false;
+        int transactionShard = -1;
+        std::shared_lock<std::shared_mutex> transactionGuard;
+
+        Database &shard(size_t i);
+        Database &reader(const std::string &uuid);
+        Database &writer(const std::string &uuid);
+        std::shared_lock<std::shared_mutex> writeLock();
+        pairing_server::Identification childId(const pairing_server::Identification &tournament);
+        std::string tournamentOf(const std::string &uuid, bool game);
+};
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef _STORAGE_H
+#define _STORAGE_H
+
+#include <exception>
+#include <string>
+#include <vector>
+
+#include "service.pb.h"
+#include "types.pb.h"
+
+/* Interface implemented by the storage engines. Database talks to Postgres,
+ * MemoryStorage keeps everything in-process and persists to a write-ahead
+ * log. The server only ever talks to a Storage, so the engine can be picked
+ * at startup. */
+class Storage {
+    public:
+        virtual ~Storage() {}
+
+        virtual void begin() = 0;
+        virtual void commit() = 0;
+        virtual void rollback() = 0;
+
+        template<typename Func>
+        void transaction(Func cb) {
+            begin();
+            try {
+                cb();
+            }
+            catch(...) {
+                rollback();
+                throw;
+            }
+            commit();
+        }
+
+        /* The insert operations use the UUID in the object's id for the new
+         * row if there is one, and generate one otherwise. */
+
+        // Operations on tournaments:
+        virtual bool getTournament(pairing_server::Tournament *t) = 0;
+        virtual int nextRound(const pairing_server::Identification *id) = 0;
+        // The number of paired games still without a result. Byes don't count.
+        virtual int unfinishedGames(const pairing_server::Identification *id) = 0;
+        virtual std::vector<pairing_server::Player> tournamentPlayers(const pairing_server::Identification *id) = 0;
+        virtual std::vector<pairing_server::Game> tournamentGames(const pairing_server::Identification *id) = 0;
+        virtual pairing_server::Identification insertTournament(const pairing_server::Tournament *t) = 0;
+
+        // Operations on players:
+        virtual bool getPlayer(pairing_server::Player *p) = 0;
+        virtual std::vector<pairing_server::Game> playerGames(const pairing_server::Identification *id) = 0;
+        virtual pairing_server::Identification insertPlayer(const pairing_server::Player *p) = 0;
+
+        // Operations on games:
+        virtual bool getGame(pairing_server::Game *g) = 0;
+        virtual pairing_server::Identification insertGame(const pairing_server::Game *g) = 0;
+        virtual void registerResult(const pairing_server::Identification &gameId, pairing_server::Result result) = 0;
+
+        // Removes a tournament with its players and games, where supported.
+        virtual void deleteTournament(const pairing_server::Identification &id);
+};
+
+class DatabaseError : public std::exception {
+    public:
+        DatabaseError(const char *dbmsg) : msg(dbmsg) {}
+        DatabaseError(std::string dbmsg) : msg(dbmsg) {}
+        const char *what() const noexcept { return msg.c_str(); }
+
+    private:
+        std::string msg;
+};
+
+inline void Storage::deleteTournament(const pairing_server::Identification &id) {
+    throw DatabaseError("This storage engine can't delete tournaments");
+}
+
+#endif
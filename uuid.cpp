@@ -0,0 +1,48 @@
+#include <openssl/rand.h>
+
+#include "storage.h"
+#include "uuid.h"
+
+std::string randomUuid() {
+    unsigned char buf[16];
+    if(RAND_bytes(&buf[0], 16) != 1)
+        throw DatabaseError("Failed to generate UUID");
+    // Version 4, variant 1.
+    buf[6] = (buf[6] & 0x0f) | 0x40;
+    buf[8] = (buf[8] & 0x3f) | 0x80;
+    return std::string((const char *) &buf[0], 16);
+}
+
+std::string toHex(const std::string &bytes) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    for(unsigned char c: bytes) {
+        hex += digits[c >> 4];
+        hex += digits[c & 0xf];
+    }
+    return hex;
+}
+
+bool fromHex(const std::string &hex, std::string *bytes) {
+    std::string out;
+    int nibble = -1;
+    for(char c: hex) {
+        int v;
+        if(c == '-') continue;
+        else if(c >= '0' && c <= '9') v = c - '0';
+        else if(c >= 'a' && c <= 'f') v = c - 'a' + 10;
+        else if(c >= 'A' && c <= 'F') v = c - 'A' + 10;
+        else return false;
+        if(nibble < 0) {
+            nibble = v;
+        }
+        else {
+            out += (char) (nibble << 4 | v);
+            nibble = -1;
+        }
+    }
+    if(nibble >= 0)
+        return false;
+    *bytes = out;
+    return true;
+}
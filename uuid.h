@@ -0,0 +1,20 @@
+#ifndef _UUID_H
+#define _UUID_H
+
+#include <string>
+
+/* Helpers for the 16-byte UUIDs that identify tournaments, players and games,
+ * shared by the storage engines and the server. */
+
+// A random version 4 UUID, like uuid_generate_v4() in Postgres.
+std::string randomUuid();
+
+// Lower-case hex digits, two per byte.
+std::string toHex(const std::string &bytes);
+
+/* Reads hex digits back into bytes. Dashes are skipped, so the usual
+ * 8-4-4-4-12 form of a UUID is accepted too. Returns false on any other
+ * character or an odd number of digits. */
+bool fromHex(const std::string &hex, std::string *bytes);
+
+#endif